@@ -0,0 +1,578 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_CYCLES (1)
+#endif
+
+#include "bench/bench.h"
+#include "a.h"
+#include "mat.h"
+#include "scratch.h"
+#include "vtxbuf.h"
+#include "lvl.h"
+#include "llvl.h"
+#include "prof.h"
+
+#define BENCH_PLAN "stress:seed=1,chunks=4"
+#define BENCH_DEFAULT_THRESHOLD (10.0) // percent
+
+volatile uint64_t bench_sink;
+
+static int n_results;
+static struct bench_result results[BENCH_MAX_RESULTS];
+static const char* filter;
+
+static uint64_t bench_cycles()
+{
+#ifdef BENCH_HAS_CYCLES
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static int cmp_double(const void* va, const void* vb)
+{
+	double a = *(const double*)va;
+	double b = *(const double*)vb;
+	return (a > b) - (a < b);
+}
+
+static int bench_enabled(const char* name)
+{
+	return filter == NULL || strstr(name, filter) != NULL;
+}
+
+void bench_run(const char* name, bench_fn fn, void* usr)
+{
+	if (!bench_enabled(name)) return;
+	ASSERT(n_results < BENCH_MAX_RESULTS);
+
+	// double n until a repetition is long enough to time reliably
+	int64_t n = 1;
+	for (;;) {
+		uint64_t t0 = prof_ns();
+		fn(usr, n);
+		if ((prof_ns() - t0) >= BENCH_MIN_REP_NS || n >= (1LL<<40)) break;
+		n *= 2;
+	}
+
+	for (int i = 0; i < BENCH_WARMUP_REPS; i++) fn(usr, n);
+
+	double ns[BENCH_REPS];
+	double cycles[BENCH_REPS];
+	for (int i = 0; i < BENCH_REPS; i++) {
+		uint64_t c0 = bench_cycles();
+		uint64_t t0 = prof_ns();
+		fn(usr, n);
+		uint64_t t1 = prof_ns();
+		uint64_t c1 = bench_cycles();
+		ns[i] = (double)(t1 - t0) / (double)n;
+		cycles[i] = (double)(c1 - c0) / (double)n;
+	}
+	qsort(ns, BENCH_REPS, sizeof(*ns), cmp_double);
+	qsort(cycles, BENCH_REPS, sizeof(*cycles), cmp_double);
+
+	struct bench_result* r = &results[n_results++];
+	r->name = name;
+	r->n = n;
+	r->median_ns = ns[BENCH_REPS/2];
+	r->p99_ns = ns[(BENCH_REPS*99)/100];
+	r->min_ns = ns[0];
+	r->median_cycles = cycles[BENCH_REPS/2];
+
+	fprintf(stderr, "%-32s %12.2f ns  (p99 %12.2f, min %12.2f, %10.1f cycles) x%lld\n",
+		r->name, r->median_ns, r->p99_ns, r->min_ns, r->median_cycles, (long long)r->n);
+}
+
+static void bench_write_json(FILE* f)
+{
+	fprintf(f, "{\n");
+	fprintf(f, "\t\"reps\": %d,\n", BENCH_REPS);
+	fprintf(f, "\t\"results\": [\n");
+	for (int i = 0; i < n_results; i++) {
+		struct bench_result* r = &results[i];
+		fprintf(f, "\t\t{\"name\": \"%s\", \"n\": %lld, \"median_ns\": %.3f, \"p99_ns\": %.3f, \"min_ns\": %.3f, \"median_cycles\": %.1f}%s\n",
+			r->name, (long long)r->n, r->median_ns, r->p99_ns, r->min_ns, r->median_cycles,
+			i < (n_results-1) ? "," : "");
+	}
+	fprintf(f, "\t]\n");
+	fprintf(f, "}\n");
+}
+
+static char* read_file(const char* path)
+{
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) return NULL;
+	fseek(f, 0, SEEK_END);
+	long sz = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char* buf = malloc(sz + 1);
+	AN(buf);
+	ASSERT(fread(buf, 1, sz, f) == (size_t)sz);
+	buf[sz] = 0;
+	fclose(f);
+	return buf;
+}
+
+// finds the median of `name` in a file written by bench_write_json(); only
+// needs to understand that format. returns 0 if it's not there
+static int baseline_median_ns(const char* json, const char* name, double* median_ns)
+{
+	char needle[256];
+	snprintf(needle, sizeof(needle), "\"name\": \"%s\"", name);
+	const char* p = strstr(json, needle);
+	if (p == NULL) return 0;
+	const char* end = strchr(p, '}');
+	const char* m = strstr(p, "\"median_ns\":");
+	if (m == NULL || (end != NULL && m > end)) return 0;
+	*median_ns = strtod(m + strlen("\"median_ns\":"), NULL);
+	return 1;
+}
+
+// returns the number of regressions
+static int bench_compare(const char* baseline_path, double threshold)
+{
+	char* json = read_file(baseline_path);
+	if (json == NULL) {
+		fprintf(stderr, "no baseline at %s; run `make bench-baseline` to create it\n", baseline_path);
+		return 0;
+	}
+
+	int n_regressions = 0;
+	fprintf(stderr, "\ncompared to %s (threshold %.1f%%):\n", baseline_path, threshold);
+	for (int i = 0; i < n_results; i++) {
+		struct bench_result* r = &results[i];
+		double base;
+		if (!baseline_median_ns(json, r->name, &base) || base <= 0) {
+			fprintf(stderr, "%-32s (new)\n", r->name);
+			continue;
+		}
+		double change = (r->median_ns / base - 1.0) * 100.0;
+		int regressed = change > threshold;
+		if (regressed) n_regressions++;
+		fprintf(stderr, "%-32s %+7.1f%%%s\n", r->name, change, regressed ? "  REGRESSION" : "");
+	}
+
+	free(json);
+	return n_regressions;
+}
+
+
+////////////////////////////////////////////////////
+// kernels
+
+// deterministic data; rand() differs between platforms
+static uint32_t lcg_state;
+
+static void lcg_seed(uint32_t seed)
+{
+	lcg_state = seed;
+}
+
+static float lcg_float(float lo, float hi)
+{
+	lcg_state = lcg_state * 1664525u + 1013904223u;
+	return lo + (hi - lo) * ((float)(lcg_state >> 8) / (float)(1 << 24));
+}
+
+#define N_QUADS (256)
+#define N_VECTORS (256)
+
+struct mtv_data {
+	struct aabb aabbs[N_QUADS];
+	union vec3 quads[N_QUADS][4];
+};
+
+static void mtv_data_init(struct mtv_data* d)
+{
+	lcg_seed(1);
+	for (int i = 0; i < N_QUADS; i++) {
+		// a floor-ish quad and a box hovering around it, so most calls run
+		// the full separating axis test
+		float x = lcg_float(-1, 1);
+		float z = lcg_float(-1, 1);
+		float s = lcg_float(0.5f, 2);
+		float tilt = lcg_float(-0.3f, 0.3f);
+		union vec3* q = d->quads[i];
+		q[0] = (union vec3) { .x = x - s, .y = -tilt, .z = z - s };
+		q[1] = (union vec3) { .x = x - s, .y = -tilt, .z = z + s };
+		q[2] = (union vec3) { .x = x + s, .y = tilt, .z = z + s };
+		q[3] = (union vec3) { .x = x + s, .y = tilt, .z = z - s };
+		d->aabbs[i].center = (union vec3) { .x = lcg_float(-1, 1), .y = lcg_float(0, 1), .z = lcg_float(-1, 1) };
+		d->aabbs[i].extent = (union vec3) { .x = 0.5f, .y = 1, .z = 0.5f };
+	}
+}
+
+static void bench_polygon_aabb_mtv(void* usr, int64_t n)
+{
+	struct mtv_data* d = usr;
+	uint64_t acc = 0;
+	for (int64_t i = 0; i < n; i++) {
+		int j = i & (N_QUADS-1);
+		union vec3 mtv;
+		acc += polygon_aabb_mtv(d->aabbs[j], d->quads[j], 4, &mtv);
+	}
+	bench_sink += acc;
+}
+
+static void bench_scratch_alloc_a8(void* usr, int64_t n)
+{
+	struct scratch* s = usr;
+	uintptr_t acc = 0;
+	for (int64_t i = 0; i < n; i++) {
+		if ((i & 1023) == 0) scratch_reset(s);
+		acc ^= (uintptr_t)scratch_alloc_a8(s, 4 + (i & 63));
+	}
+	bench_sink += acc;
+}
+
+static void bench_scratch_alloc_a16(void* usr, int64_t n)
+{
+	struct scratch* s = usr;
+	uintptr_t acc = 0;
+	for (int64_t i = 0; i < n; i++) {
+		if ((i & 1023) == 0) scratch_reset(s);
+		acc ^= (uintptr_t)scratch_alloc_a16(s, 4 + (i & 63));
+	}
+	bench_sink += acc;
+}
+
+#define VTXBUF_TRIANGLE_SIZE (48) // 3 render_vertex
+
+static void bench_vtxbuf_element(void* usr, int64_t n)
+{
+	struct vtxbuf* vb = usr;
+	uint8_t triangle[VTXBUF_TRIANGLE_SIZE];
+	memset(triangle, 0x5a, sizeof(triangle));
+	for (int64_t i = 0; i < n; i++) {
+		// flushing needs GL; rewind instead, so only the copy is measured
+		if ((vb->used + sizeof(triangle)) > vb->sz) vb->used = 0;
+		triangle[0] = i;
+		vtxbuf_element(vb, triangle, sizeof(triangle));
+	}
+	bench_sink += vb->used;
+}
+
+// per quad, written in place as 4 vertices and 6 indices; what
+// render_flat_quad() does
+static void bench_vtxbuf_reserve_indexed(void* usr, int64_t n)
+{
+	struct vtxbuf* vb = usr;
+	for (int64_t i = 0; i < n; i++) {
+		if ((vb->used + 4*vb->shader->stride) > vb->sz || (vb->n_indices + 6) > vb->index_capacity) {
+			vb->used = 0;
+			vb->n_indices = 0;
+		}
+		uint16_t* indices;
+		uint16_t base;
+		uint32_t* vertices = vtxbuf_reserve_indexed(vb, 4, 6, &indices, &base);
+		for (int j = 0; j < 4; j++) {
+			vertices[j*4+0] = i;
+			vertices[j*4+1] = j;
+			vertices[j*4+2] = 0;
+			vertices[j*4+3] = 0;
+		}
+		for (int j = 0; j < 2; j++) {
+			*(indices++) = base;
+			*(indices++) = base + j + 1;
+			*(indices++) = base + j + 2;
+		}
+		vtxbuf_commit_indexed(vb, 4, 6);
+	}
+	bench_sink += vb->used;
+}
+
+static void bench_mat44_multiply(void* usr, int64_t n)
+{
+	struct mat44* ms = usr;
+	struct mat44 acc = mat44_identity();
+	for (int64_t i = 0; i < n; i++) {
+		acc = mat44_multiply(acc, ms[i&3]);
+	}
+	bench_sink += (uint64_t)(acc.s[0] != 0);
+}
+
+static void bench_mat44_multiply_scalar(void* usr, int64_t n)
+{
+	struct mat44* ms = usr;
+	struct mat44 acc = mat44_identity();
+	for (int64_t i = 0; i < n; i++) {
+		acc = mat44_multiply_scalar(acc, ms[i&3]);
+	}
+	bench_sink += (uint64_t)(acc.s[0] != 0);
+}
+
+static void bench_mat44_rotation(void* usr, int64_t n)
+{
+	union vec3 axis = { .x = 0.267f, .y = 0.535f, .z = 0.802f };
+	float sum = 0;
+	for (int64_t i = 0; i < n; i++) {
+		struct mat44 m = mat44_rotation((float)(i & 255) * 0.0245f, axis);
+		sum += m.s[1];
+	}
+	bench_sink += (uint64_t)(sum != 0);
+}
+
+static void bench_vec3_normalize(void* usr, int64_t n)
+{
+	union vec3* vs = usr;
+	float sum = 0;
+	for (int64_t i = 0; i < n; i++) sum += vec3_normalize(vs[i & (N_VECTORS-1)]).x;
+	bench_sink += (uint64_t)(sum != 0);
+}
+
+static void bench_vec3_normalize_fast(void* usr, int64_t n)
+{
+	union vec3* vs = usr;
+	float sum = 0;
+	for (int64_t i = 0; i < n; i++) sum += vec3_normalize_fast(vs[i & (N_VECTORS-1)]).x;
+	bench_sink += (uint64_t)(sum != 0);
+}
+
+// per point
+static void bench_mat44_transform_point_batch(void* usr, int64_t n)
+{
+	union vec3* vs = usr;
+	union vec3 out[N_VECTORS];
+	union vec3 axis = { .x = 0, .y = 1, .z = 0 };
+	struct mat44 m = mat44_rotation(30, axis);
+	for (int64_t i = 0; i < n; i += N_VECTORS) {
+		int64_t left = n - i;
+		mat44_transform_point_batch(m, left < N_VECTORS ? left : N_VECTORS, vs, out);
+	}
+	bench_sink += (uint64_t)(out[0].x != 0);
+}
+
+static int mat44_equal(struct mat44 a, struct mat44 b)
+{
+	for (int i = 0; i < 16; i++) if (a.s[i] != b.s[i]) return 0;
+	return 1;
+}
+
+// the SIMD paths in mat.h must agree with the scalar ones; see mat.h
+static void check_mat()
+{
+	lcg_seed(3);
+	for (int i = 0; i < 1000; i++) {
+		struct mat44 a, b;
+		for (int j = 0; j < 16; j++) {
+			a.s[j] = lcg_float(-10, 10);
+			b.s[j] = lcg_float(-10, 10);
+		}
+		if (!mat44_equal(mat44_multiply(a, b), mat44_multiply_scalar(a, b))) arghf("mat44_multiply() disagrees with mat44_multiply_scalar()");
+
+		union vec4 v = {{lcg_float(-10, 10), lcg_float(-10, 10), lcg_float(-10, 10), lcg_float(-10, 10)}};
+		union vec4 r0 = mat44_transform(a, v);
+		union vec4 r1 = mat44_transform_scalar(a, v);
+		union vec4 r2;
+		mat44_transform_batch(a, 1, &v, &r2);
+		for (int j = 0; j < 4; j++) {
+			if (r0.s[j] != r1.s[j] || r2.s[j] != r1.s[j]) arghf("mat44_transform*() disagrees with mat44_transform_scalar()");
+		}
+
+		union vec3 p = vec3_xyz(v.x, v.y, v.z);
+		union vec4 pw = {{v.x, v.y, v.z, 1}};
+		union vec4 q = mat44_transform_scalar(a, pw);
+		union vec3 q0 = mat44_transform_point(a, p);
+		union vec3 q1;
+		mat44_transform_point_batch(a, 1, &p, &q1);
+		for (int j = 0; j < 3; j++) {
+			if (q0.s[j] != q.s[j] || q1.s[j] != q.s[j]) arghf("mat44_transform_point*() disagrees with mat44_transform_scalar()");
+		}
+
+		// refined rsqrt estimate; a few ulp
+		union vec3 n0 = vec3_normalize_fast(p);
+		union vec3 n1 = vec3_normalize(p);
+		for (int j = 0; j < 3; j++) {
+			if (fabsf(n0.s[j] - n1.s[j]) > 1e-6f) arghf("vec3_normalize_fast() disagrees with vec3_normalize(): %.9g vs %.9g", n0.s[j], n1.s[j]);
+		}
+	}
+}
+
+struct lvl_bench {
+	struct lvl lvl;
+	int polygon_list_size; // of chunk 0
+	struct aabb aabbs[N_QUADS];
+};
+
+static int polygon_list_size(uint32_t* polygon_list)
+{
+	int i = 0;
+	while (polygon_list[i] != 0) i += 2 + polygon_list[i];
+	return i + 1;
+}
+
+static void bench_lvl_chunk_validate_polygon_list(void* usr, int64_t n)
+{
+	struct lvl_bench* b = usr;
+	struct lvl_chunk* chunk = &b->lvl.chunks[0];
+	char errstr1024[1024];
+	for (int64_t i = 0; i < n; i++) {
+		AZ(lvl_chunk_validate_polygon_list(&b->lvl, chunk, chunk->n_vertices, b->polygon_list_size, errstr1024));
+	}
+}
+
+static void bench_lvl_aabb_mtv_iterator(void* usr, int64_t n)
+{
+	struct lvl_bench* b = usr;
+	uint64_t acc = 0;
+	for (int64_t i = 0; i < n; i++) {
+		acc += bench_lvl_mtv_query(&b->lvl, 0, b->aabbs[i & (N_QUADS-1)]);
+	}
+	bench_sink += acc;
+}
+
+static void bench_lvl_build_pvs(void* usr, int64_t n)
+{
+	struct lvl_bench* b = usr;
+	// reuses the pvs allocated by populate_lvl()
+	for (int64_t i = 0; i < n; i++) AN(lvl_build_pvs(&b->lvl, NULL));
+}
+
+static void bench_populate_lvl(void* usr, int64_t n)
+{
+	for (int64_t i = 0; i < n; i++) {
+		struct lvl lvl;
+		bench_llvl_populate(usr, &lvl);
+		lvl_free(&lvl);
+	}
+}
+
+static void usage(const char* prg)
+{
+	fprintf(stderr, "usage: %s [--json <path>] [--baseline <path>] [--threshold <percent>] [--filter <substring>]\n", prg);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+	const char* json_path = NULL;
+	const char* baseline_path = NULL;
+	double threshold = BENCH_DEFAULT_THRESHOLD;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		if ((i+1) >= argc) usage(argv[0]);
+		const char* value = argv[++i];
+		if (strcmp(arg, "--json") == 0) {
+			json_path = value;
+		} else if (strcmp(arg, "--baseline") == 0) {
+			baseline_path = value;
+		} else if (strcmp(arg, "--threshold") == 0) {
+			threshold = atof(value);
+		} else if (strcmp(arg, "--filter") == 0) {
+			filter = value;
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	check_mat();
+
+	{
+		struct mtv_data* d = malloc(sizeof(*d));
+		AN(d);
+		mtv_data_init(d);
+		bench_run("polygon_aabb_mtv", bench_polygon_aabb_mtv, d);
+		free(d);
+	}
+
+	{
+		struct scratch s;
+		scratch_init(&s, 1<<16);
+		bench_run("scratch_alloc_a8", bench_scratch_alloc_a8, &s);
+		bench_run("scratch_alloc_a16", bench_scratch_alloc_a16, &s);
+		scratch_free(&s);
+	}
+
+	{
+		// set up by hand; vtxbuf_init() creates GL buffers
+		struct vtxbuf vb;
+		memset(&vb, 0, sizeof(vb));
+		vb.sz = 1<<16;
+		vb.data = malloc(vb.sz);
+		AN(vb.data);
+		bench_run("vtxbuf_element", bench_vtxbuf_element, &vb);
+
+		struct shader shader;
+		memset(&shader, 0, sizeof(shader));
+		shader.stride = 16; // like render_vertex
+		vb.shader = &shader;
+		vb.indexed = 1;
+		vb.index_capacity = vb.sz / sizeof(*vb.indices);
+		vb.indices = malloc(vb.index_capacity * sizeof(*vb.indices));
+		AN(vb.indices);
+		vb.used = 0;
+		bench_run("vtxbuf_reserve_indexed", bench_vtxbuf_reserve_indexed, &vb);
+		free(vb.indices);
+		free(vb.data);
+	}
+
+	{
+		union vec3 axis = { .x = 0, .y = 1, .z = 0 };
+		union vec3 d = { .x = 0.1f, .y = 0.2f, .z = 0.3f };
+		struct mat44 ms[4] = {
+			mat44_rotation(0.1f, axis),
+			mat44_translation(d),
+			mat44_rotation(-0.1f, axis),
+			mat44_translation(vec3_scale(d, -1)),
+		};
+		bench_run("mat44_multiply", bench_mat44_multiply, ms);
+		bench_run("mat44_multiply_scalar", bench_mat44_multiply_scalar, ms);
+		bench_run("mat44_rotation", bench_mat44_rotation, NULL);
+	}
+
+	{
+		union vec3 vs[N_VECTORS];
+		lcg_seed(4);
+		for (int i = 0; i < N_VECTORS; i++) vs[i] = vec3_xyz(lcg_float(-10, 10), lcg_float(-10, 10), lcg_float(-10, 10));
+		bench_run("vec3_normalize", bench_vec3_normalize, vs);
+		bench_run("vec3_normalize_fast", bench_vec3_normalize_fast, vs);
+		bench_run("mat44_transform_point_batch", bench_mat44_transform_point_batch, vs);
+	}
+
+	// building the level takes a while; skip it when filtered out
+	if (bench_enabled("lvl_chunk_validate_polygon_list") || bench_enabled("lvl_aabb_mtv_iterator_next") || bench_enabled("lvl_build_pvs")) {
+		struct lvl_bench* b = malloc(sizeof(*b));
+		AN(b);
+		llvl_build(BENCH_PLAN, &b->lvl, NULL);
+		b->polygon_list_size = polygon_list_size(b->lvl.chunks[0].polygon_list);
+		lcg_seed(2);
+		for (int i = 0; i < N_QUADS; i++) {
+			// the player's box, standing on or sinking into the floor
+			b->aabbs[i].center = (union vec3) { .x = lcg_float(-14, 14), .y = lcg_float(-0.2f, 0.1f), .z = lcg_float(-14, 14) };
+			b->aabbs[i].extent = (union vec3) { .x = 0.5f, .y = 1, .z = 0.5f };
+		}
+		bench_run("lvl_chunk_validate_polygon_list", bench_lvl_chunk_validate_polygon_list, b);
+		bench_run("lvl_aabb_mtv_iterator_next", bench_lvl_aabb_mtv_iterator, b);
+		bench_run("lvl_build_pvs", bench_lvl_build_pvs, b);
+		lvl_free(&b->lvl);
+		free(b);
+	}
+
+	if (bench_enabled("populate_lvl")) {
+		void* state = bench_llvl_open(BENCH_PLAN);
+		bench_run("populate_lvl", bench_populate_lvl, state);
+		bench_llvl_close(state);
+	}
+
+	if (json_path != NULL) {
+		FILE* f = fopen(json_path, "w");
+		if (f == NULL) arghf("%s: could not open for writing", json_path);
+		bench_write_json(f);
+		fclose(f);
+	} else {
+		bench_write_json(stdout);
+	}
+
+	if (baseline_path != NULL && bench_compare(baseline_path, threshold) > 0) {
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
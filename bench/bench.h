@@ -0,0 +1,48 @@
+#ifndef BENCH_H
+
+#include <stdint.h>
+
+#include "lvl.h"
+
+/*
+micro-benchmark harness for engine kernels; see bench.c and `make bench`.
+
+a benchmark is a function running `n` iterations of a kernel. each is
+calibrated so one repetition takes at least BENCH_MIN_REP_NS, warmed up,
+then timed over BENCH_REPS repetitions; median, p99 and min are reported
+per iteration, plus cycles where a cycle counter is available.
+*/
+
+#define BENCH_WARMUP_REPS (3)
+#define BENCH_REPS (31)
+#define BENCH_MIN_REP_NS (2000000)
+#define BENCH_MAX_RESULTS (64)
+
+typedef void (*bench_fn)(void* usr, int64_t n);
+
+struct bench_result {
+	const char* name;
+	int64_t n; // iterations per repetition
+	double median_ns;
+	double p99_ns;
+	double min_ns;
+	double median_cycles; // 0 without a cycle counter
+};
+
+// results are kept for bench_write_json() and bench_compare()
+void bench_run(const char* name, bench_fn fn, void* usr);
+
+// written by kernels so the compiler can't drop their work
+extern volatile uint64_t bench_sink;
+
+// bench_lvl.c; lvl.c internals
+int bench_lvl_mtv_query(struct lvl* lvl, uint32_t chunk_index, struct aabb aabb);
+
+// bench_llvl.c; llvl.c internals. the compiled plan is kept in a Lua state
+// so populate_lvl() can be timed on its own
+void* bench_llvl_open(const char* plan);
+void bench_llvl_populate(void* state, struct lvl* lvl);
+void bench_llvl_close(void* state);
+
+#define BENCH_H
+#endif
@@ -0,0 +1,42 @@
+// built as part of llvl.c, for access to its static functions
+#include "llvl.c"
+
+#include "bench/bench.h"
+
+void* bench_llvl_open(const char* plan)
+{
+	// only one state is open at a time; the cache keeps a pointer to this
+	static struct llvl_build_stats st;
+	memset(&st, 0, sizeof(st));
+
+	lua_State* L = luaL_newstate();
+	AN(L);
+	luaL_openlibs(L);
+	setup_package_path(L);
+	setup_bytecode_cache(L, &st);
+	lcounters_open(L);
+
+	lua_getglobal(L, "require");
+	lua_pushstring(L, "build");
+	ASSERT(pcall(L, 1, 1, NULL, 0) == LLVL_LOAD_DONE);
+	lua_pushstring(L, plan);
+	ASSERT(pcall(L, 1, 1, NULL, 0) == LLVL_LOAD_DONE);
+	lua_setfield(L, LUA_REGISTRYINDEX, "bench_clvl");
+
+	return L;
+}
+
+void bench_llvl_populate(void* state, struct lvl* lvl)
+{
+	lua_State* L = state;
+	lua_pushcfunction(L, l_populate_lvl);
+	lua_pushlightuserdata(L, lvl);
+	lua_pushlightuserdata(L, NULL);
+	lua_getfield(L, LUA_REGISTRYINDEX, "bench_clvl");
+	ASSERT(pcall(L, 3, 0, NULL, 0) == LLVL_LOAD_DONE);
+}
+
+void bench_llvl_close(void* state)
+{
+	lua_close(state);
+}
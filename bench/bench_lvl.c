@@ -0,0 +1,13 @@
+// built as part of lvl.c, for access to its static functions
+#include "lvl.c"
+
+#include "bench/bench.h"
+
+int bench_lvl_mtv_query(struct lvl* lvl, uint32_t chunk_index, struct aabb aabb)
+{
+	struct lvl_aabb_mtv_iterator it;
+	lvl_aabb_mtv_iterator_init(&it, lvl, aabb, chunk_index);
+	int n_hits = 0;
+	while (lvl_aabb_mtv_iterator_next(&it)) n_hits++;
+	return n_hits;
+}
@@ -0,0 +1,87 @@
+#include "counters.h"
+#include "a.h"
+
+int64_t counters_current[COUNTER_MAX];
+
+static struct {
+	int64_t frame_number;
+	int64_t frame[COUNTER_MAX];
+	int64_t total[COUNTER_MAX];
+	FILE* csv;
+} counters;
+
+static const char* counter_names[COUNTER_MAX] = {
+	"mtv_polygons",
+	"sat_tests",
+	"sat_hits",
+	"step_up_probes",
+	"clipmove_substeps",
+	"contact_gathers",
+	"sleeping_updates",
+	"vtxbuf_triangles",
+	"vtxbuf_bytes",
+	"vtxbuf_flushes",
+	"draw_calls",
+};
+
+void counters_frame_end()
+{
+	for (int i = 0; i < COUNTER_MAX; i++) {
+		counters.frame[i] = counters_current[i];
+		counters.total[i] += counters_current[i];
+		counters_current[i] = 0;
+	}
+
+	if (counters.csv) {
+		fprintf(counters.csv, "%lld", (long long)counters.frame_number);
+		for (int i = 0; i < COUNTER_MAX; i++) fprintf(counters.csv, ",%lld", (long long)counters.frame[i]);
+		fprintf(counters.csv, "\n");
+	}
+
+	counters.frame_number++;
+}
+
+const char* counters_name(enum counter counter)
+{
+	ASSERT(counter >= 0 && counter < COUNTER_MAX);
+	return counter_names[counter];
+}
+
+int64_t counters_get_frame(enum counter counter)
+{
+	ASSERT(counter >= 0 && counter < COUNTER_MAX);
+	return counters.frame[counter];
+}
+
+int64_t counters_get_total(enum counter counter)
+{
+	ASSERT(counter >= 0 && counter < COUNTER_MAX);
+	return counters.total[counter];
+}
+
+void counters_dump(FILE* f)
+{
+	#ifndef COUNTERS
+	fprintf(f, "(counters not compiled in; build with -DCOUNTERS)\n");
+	#endif
+	fprintf(f, "%-20s %12s %16s\n", "counter", "last frame", "total");
+	for (int i = 0; i < COUNTER_MAX; i++) {
+		fprintf(f, "%-20s %12lld %16lld\n", counter_names[i], (long long)counters.frame[i], (long long)counters.total[i]);
+	}
+}
+
+void counters_csv_open(const char* path)
+{
+	counters_csv_close();
+	counters.csv = fopen(path, "w");
+	if (counters.csv == NULL) arghf("%s: could not open for writing", path);
+	fprintf(counters.csv, "frame");
+	for (int i = 0; i < COUNTER_MAX; i++) fprintf(counters.csv, ",%s", counter_names[i]);
+	fprintf(counters.csv, "\n");
+}
+
+void counters_csv_close()
+{
+	if (counters.csv) fclose(counters.csv);
+	counters.csv = NULL;
+}
@@ -0,0 +1,53 @@
+#ifndef COUNTERS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+work counters for the sim and renderer, to tell whether a slow map is slow
+because of polygon count, step-up probing or draw calls. counts accumulate
+into the current frame; counters_frame_end() moves them to "last frame" and
+adds them to the running totals (and writes a CSV row, see
+counters_csv_open()). Lua gets a read-only view via lcounters.h.
+
+COUNTER_ADD() compiles to nothing unless built with -DCOUNTERS (see
+Makefile.linux); the reading side is always there and reports zeros.
+
+main thread only.
+*/
+
+enum counter {
+	COUNTER_MTV_POLYGONS = 0, // polygons visited by lvl_aabb_mtv_iterator_next()
+	COUNTER_SAT_TESTS, // polygon_aabb_mtv() calls
+	COUNTER_SAT_HITS, // ... that found an intersection
+	COUNTER_STEP_UP_PROBES,
+	COUNTER_CLIPMOVE_SUBSTEPS,
+	COUNTER_CONTACT_GATHERS, // contact cache refills (see lvl_contact_cache)
+	COUNTER_SLEEPING_UPDATES, // lvl_entity_update() calls skipped by sleeping entities
+	COUNTER_VTXBUF_TRIANGLES,
+	COUNTER_VTXBUF_BYTES,
+	COUNTER_VTXBUF_FLUSHES,
+	COUNTER_DRAW_CALLS,
+	COUNTER_MAX
+};
+
+extern int64_t counters_current[COUNTER_MAX];
+
+#ifdef COUNTERS
+#define COUNTER_ADD(counter, n) do { counters_current[counter] += (n); } while (0)
+#else
+#define COUNTER_ADD(counter, n) do {} while (0)
+#endif
+
+void counters_frame_end();
+
+const char* counters_name(enum counter counter);
+int64_t counters_get_frame(enum counter counter); // last complete frame
+int64_t counters_get_total(enum counter counter);
+
+void counters_dump(FILE* f);
+void counters_csv_open(const char* path); // per-frame CSV rows until counters_csv_close()
+void counters_csv_close();
+
+#define COUNTERS_H
+#endif
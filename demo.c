@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "demo.h"
+#include "a.h"
+
+static const char demo_magic[8] = "FMTPDEMO";
+
+#define DEMO_HEADER_SIZE (8 + 4 + 4 + DEMO_PLAN_MAX_LENGTH)
+
+static void put_u16(uint8_t* p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t* p, uint32_t v)
+{
+	for (int i = 0; i < 4; i++) p[i] = v >> (i*8);
+}
+
+static uint16_t get_u16(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t* p)
+{
+	uint32_t v = 0;
+	for (int i = 0; i < 4; i++) v |= (uint32_t)p[i] << (i*8);
+	return v;
+}
+
+static uint32_t float_bits(float f)
+{
+	uint32_t u;
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
+
+void demo_apply_look(struct lvl_entity* e, int mdx, int mdy)
+{
+	float sensitivity = 0.1f;
+	lvl_entity_dlook(e, (float)mdx * sensitivity, (float)mdy * sensitivity);
+}
+
+void demo_apply_input(struct lvl_entity* e, struct demo_input* input)
+{
+	demo_apply_look(e, input->mdx, input->mdy);
+
+	uint8_t b = input->buttons;
+	float forward = (float)(!!(b & DEMO_FORWARD) - !!(b & DEMO_BACKWARD));
+	float right = (float)(!!(b & DEMO_RIGHT) - !!(b & DEMO_LEFT));
+	lvl_entity_move(e, forward, right, (b & DEMO_JUMP) ? 1.0 : 0.0);
+}
+
+uint32_t demo_entity_hash(struct lvl_entity* e)
+{
+	uint32_t words[9];
+	words[0] = e->chunk_index;
+	for (int i = 0; i < 3; i++) words[1+i] = float_bits(e->position.s[i]);
+	for (int i = 0; i < 3; i++) words[4+i] = float_bits(e->velocity.s[i]);
+	words[7] = float_bits(e->yaw);
+	words[8] = float_bits(e->pitch);
+
+	uint32_t hash = 0x811c9dc5;
+	for (int i = 0; i < 9; i++) {
+		for (int j = 0; j < 4; j++) {
+			hash ^= (words[i] >> (j*8)) & 0xff;
+			hash *= 0x01000193;
+		}
+	}
+	return hash;
+}
+
+void demo_record_open(struct demo* demo, const char* path, const char* plan, float dt)
+{
+	memset(demo, 0, sizeof(*demo));
+	ASSERT(strlen(plan) < DEMO_PLAN_MAX_LENGTH);
+	strcpy(demo->plan, plan);
+	demo->dt = dt;
+
+	demo->f = fopen(path, "wb");
+	if (demo->f == NULL) arghf("%s: could not open for writing", path);
+
+	uint8_t header[DEMO_HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+	memcpy(header, demo_magic, 8);
+	put_u32(header + 8, DEMO_VERSION);
+	put_u32(header + 12, float_bits(dt));
+	memcpy(header + 16, demo->plan, strlen(demo->plan));
+	AN(fwrite(header, sizeof(header), 1, demo->f));
+}
+
+void demo_record_tick(struct demo* demo, struct demo_input* input, uint32_t hash)
+{
+	AN(demo->f);
+	uint8_t rec[DEMO_TICK_SIZE];
+	rec[0] = input->buttons;
+	put_u16(rec + 1, input->mdx);
+	put_u16(rec + 3, input->mdy);
+	put_u32(rec + 5, hash);
+	AN(fwrite(rec, sizeof(rec), 1, demo->f));
+}
+
+void demo_record_close(struct demo* demo)
+{
+	AN(demo->f);
+	AZ(fclose(demo->f));
+	demo->f = NULL;
+}
+
+void demo_load(struct demo* demo, const char* path)
+{
+	memset(demo, 0, sizeof(*demo));
+
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) arghf("%s: could not open", path);
+
+	uint8_t header[DEMO_HEADER_SIZE];
+	if (fread(header, sizeof(header), 1, f) != 1) arghf("%s: truncated header", path);
+	if (memcmp(header, demo_magic, 8) != 0) arghf("%s: not a demo", path);
+	uint32_t version = get_u32(header + 8);
+	if (version != DEMO_VERSION) arghf("%s: version %u, expected %d", path, version, DEMO_VERSION);
+	uint32_t dt_bits = get_u32(header + 12);
+	memcpy(&demo->dt, &dt_bits, sizeof(demo->dt));
+	memcpy(demo->plan, header + 16, DEMO_PLAN_MAX_LENGTH);
+	demo->plan[DEMO_PLAN_MAX_LENGTH - 1] = 0;
+
+	AZ(fseek(f, 0, SEEK_END));
+	long size = ftell(f) - DEMO_HEADER_SIZE;
+	AZ(fseek(f, DEMO_HEADER_SIZE, SEEK_SET));
+	if (size % DEMO_TICK_SIZE != 0) arghf("%s: truncated tick", path);
+	demo->n_ticks = size / DEMO_TICK_SIZE;
+
+	uint8_t* data = malloc(size + 1);
+	AN(data);
+	AN(demo->ticks = calloc(demo->n_ticks + 1, sizeof(*demo->ticks)));
+	if (size > 0 && fread(data, size, 1, f) != 1) arghf("%s: read error", path);
+	for (int i = 0; i < demo->n_ticks; i++) {
+		const uint8_t* rec = data + i * DEMO_TICK_SIZE;
+		struct demo_tick* tick = &demo->ticks[i];
+		tick->input.buttons = rec[0];
+		tick->input.mdx = (int16_t)get_u16(rec + 1);
+		tick->input.mdy = (int16_t)get_u16(rec + 3);
+		tick->hash = get_u32(rec + 5);
+	}
+
+	free(data);
+	fclose(f);
+}
+
+void demo_free(struct demo* demo)
+{
+	free(demo->ticks);
+	memset(demo, 0, sizeof(*demo));
+}
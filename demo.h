@@ -0,0 +1,64 @@
+#ifndef DEMO_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lvl.h"
+
+/*
+input recording ("demos"). every sim tick, the player's input is written to
+a file together with a hash of the resulting entity state; replaying feeds
+the same inputs through the same sim (demo_apply_input() +
+lvl_entity_update()) and compares hashes tick by tick. both main and the
+headless replay go through demo_apply_input(), so live play and replay
+can't drift apart.
+
+file format: a header (magic, version, dt, plan name) followed by one
+DEMO_TICK_SIZE byte record per tick, little-endian, until end of file.
+*/
+
+#define DEMO_VERSION (1)
+#define DEMO_PLAN_MAX_LENGTH (64)
+#define DEMO_TICK_SIZE (9)
+
+#define DEMO_FORWARD (1<<0)
+#define DEMO_BACKWARD (1<<1)
+#define DEMO_LEFT (1<<2)
+#define DEMO_RIGHT (1<<3)
+#define DEMO_JUMP (1<<4)
+
+struct demo_input {
+	uint8_t buttons;
+	int16_t mdx, mdy; // relative mouse motion
+};
+
+struct demo_tick {
+	struct demo_input input;
+	uint32_t hash; // demo_entity_hash() after the tick
+};
+
+struct demo {
+	char plan[DEMO_PLAN_MAX_LENGTH];
+	float dt;
+
+	// recording
+	FILE* f;
+
+	// playback
+	int n_ticks;
+	struct demo_tick* ticks;
+};
+
+void demo_apply_input(struct lvl_entity* e, struct demo_input* input);
+void demo_apply_look(struct lvl_entity* e, int mdx, int mdy); // mouse part of demo_apply_input()
+uint32_t demo_entity_hash(struct lvl_entity* e);
+
+void demo_record_open(struct demo* demo, const char* path, const char* plan, float dt);
+void demo_record_tick(struct demo* demo, struct demo_input* input, uint32_t hash);
+void demo_record_close(struct demo* demo);
+
+void demo_load(struct demo* demo, const char* path);
+void demo_free(struct demo* demo);
+
+#define DEMO_H
+#endif
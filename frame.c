@@ -0,0 +1,110 @@
+#include <stdio.h>
+
+#include "frame.h"
+
+static struct {
+	int initialized;
+	int current;
+	int n_blocks_at_begin;
+
+	struct scratch arenas[2];
+
+	struct frame_stats stats;
+} frame;
+
+#ifdef FRAME_MALLOC_CHECK
+// requires linking with -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc.
+// thread local so that only the thread running frame_begin()/frame_end()
+// counts; loader and job threads allocating at their own pace aren't on the
+// frame's hot path
+static __thread int frame_hot;
+static volatile int64_t frame_hot_mallocs;
+
+void* __real_malloc(size_t sz);
+void* __real_calloc(size_t n, size_t sz);
+void* __real_realloc(void* p, size_t sz);
+
+void* __wrap_malloc(size_t sz)
+{
+	if (frame_hot) __sync_fetch_and_add(&frame_hot_mallocs, 1);
+	return __real_malloc(sz);
+}
+
+void* __wrap_calloc(size_t n, size_t sz)
+{
+	if (frame_hot) __sync_fetch_and_add(&frame_hot_mallocs, 1);
+	return __real_calloc(n, sz);
+}
+
+void* __wrap_realloc(void* p, size_t sz)
+{
+	if (frame_hot) __sync_fetch_and_add(&frame_hot_mallocs, 1);
+	return __real_realloc(p, sz);
+}
+#endif
+
+static int frame_n_blocks()
+{
+	return frame.arenas[0].stats.n_blocks + frame.arenas[1].stats.n_blocks;
+}
+
+void frame_init(size_t increment)
+{
+	memset(&frame, 0, sizeof(frame));
+	for (int i = 0; i < 2; i++) scratch_init(&frame.arenas[i], increment);
+	frame.initialized = 1;
+}
+
+void frame_free()
+{
+	for (int i = 0; i < 2; i++) scratch_free(&frame.arenas[i]);
+	memset(&frame, 0, sizeof(frame));
+}
+
+void frame_begin()
+{
+	ASSERT(frame.initialized);
+
+	frame.current ^= 1;
+	scratch_reset(&frame.arenas[frame.current]);
+	frame.n_blocks_at_begin = frame_n_blocks();
+
+	#ifdef FRAME_MALLOC_CHECK
+	frame_hot = 1;
+	#endif
+}
+
+void frame_end()
+{
+	ASSERT(frame.initialized);
+
+	#ifdef FRAME_MALLOC_CHECK
+	frame_hot = 0;
+	int64_t n_hot_mallocs = frame_hot_mallocs - frame.stats.n_hot_mallocs;
+	if (n_hot_mallocs > 0 && frame.stats.frame_number >= FRAME_WARMUP_FRAMES) {
+		fprintf(stderr, "frame %lld: %lld malloc(s) on the hot path\n", (long long)frame.stats.frame_number, (long long)n_hot_mallocs);
+	}
+	frame.stats.n_hot_mallocs = frame_hot_mallocs;
+	#endif
+
+	// arena growth means a malloc() on the hot path, even without
+	// FRAME_MALLOC_CHECK
+	int n_blocks = frame_n_blocks();
+	if (n_blocks > frame.n_blocks_at_begin && frame.stats.frame_number >= FRAME_WARMUP_FRAMES) {
+		frame.stats.n_growing_frames++;
+		fprintf(stderr, "frame %lld: frame arenas grew to %d blocks\n", (long long)frame.stats.frame_number, n_blocks);
+	}
+
+	frame.stats.frame_number++;
+}
+
+struct scratch* frame_scratch()
+{
+	ASSERT(frame.initialized);
+	return &frame.arenas[frame.current];
+}
+
+struct frame_stats frame_get_stats()
+{
+	return frame.stats;
+}
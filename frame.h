@@ -0,0 +1,51 @@
+#ifndef FRAME_H
+
+#include <stdint.h>
+
+#include "scratch.h"
+
+/*
+per-frame transient memory. there are two arenas which alternate between
+frames; frame_begin() resets the one about to be used, so anything
+allocated during frame N stays valid until frame N+1 ends. the arenas
+belong to the thread running the frame loop. there are no per-thread
+arenas: the only work on worker threads (level loads, the PVS build)
+spans many frames, and would have its memory reset under it.
+
+memory allocated in the steady state should come from here (or be
+preallocated), not from malloc(). frame_end() reports frames in which the
+arenas had to grow after warmup. building with FRAME_MALLOC_CHECK (see
+Makefile.linux) additionally counts every malloc()/calloc()/realloc() made
+between frame_begin() and frame_end() on the thread that called them.
+*/
+
+#define FRAME_WARMUP_FRAMES (8)
+
+void frame_init(size_t increment);
+void frame_free();
+
+void frame_begin();
+void frame_end();
+
+struct scratch* frame_scratch(); // arena for the current frame; frame loop thread only
+
+inline static void* frame_alloc(size_t sz)
+{
+	return scratch_alloc(frame_scratch(), sz);
+}
+
+inline static void* frame_alloc_a16(size_t sz)
+{
+	return scratch_alloc_a16(frame_scratch(), sz);
+}
+
+struct frame_stats {
+	int64_t frame_number;
+	int n_growing_frames; // frames after warmup in which arenas grew
+	int64_t n_hot_mallocs; // only counted with FRAME_MALLOC_CHECK
+};
+
+struct frame_stats frame_get_stats();
+
+#define FRAME_H
+#endif
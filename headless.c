@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "headless.h"
+#include "llvl.h"
+#include "render.h"
+#include "prof.h"
+#include "frame.h"
+#include "demo.h"
+#include "trace.h"
+#include "counters.h"
+#include "a.h"
+
+#define EGL_ASSERT(cond) do { if (!(cond)) { arghf("EGL_ASSERT(%s) failed with error 0x%x in %s() in %s:%d\n", #cond, eglGetError(), __func__, __FILE__, __LINE__); } } while (0)
+
+struct headless_egl {
+	EGLDisplay display;
+	EGLContext context;
+	EGLSurface surface;
+};
+
+static int has_extension(const char* extensions, const char* name)
+{
+	if (extensions == NULL) return 0;
+	size_t len = strlen(name);
+	for (const char* p = extensions; (p = strstr(p, name)) != NULL; p += len) {
+		if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == 0)) return 1;
+	}
+	return 0;
+}
+
+static void headless_egl_init(struct headless_egl* egl)
+{
+	memset(egl, 0, sizeof(*egl));
+	egl->display = EGL_NO_DISPLAY;
+
+	// prefer the surfaceless platform; needs neither X nor a GPU
+	const char* client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (has_extension(client_extensions, "EGL_MESA_platform_surfaceless")) {
+		PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (get_platform_display) {
+			egl->display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		}
+	}
+	if (egl->display == EGL_NO_DISPLAY) egl->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	EGL_ASSERT(egl->display != EGL_NO_DISPLAY);
+
+	EGLint major, minor;
+	EGL_ASSERT(eglInitialize(egl->display, &major, &minor));
+	EGL_ASSERT(eglBindAPI(EGL_OPENGL_API));
+
+	int surfaceless = has_extension(eglQueryString(egl->display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context");
+
+	EGLint config_attrs[] = {
+		EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint n_configs = 0;
+	EGL_ASSERT(eglChooseConfig(egl->display, config_attrs, &config, 1, &n_configs));
+	EGL_ASSERT(n_configs > 0);
+
+	egl->context = eglCreateContext(egl->display, config, EGL_NO_CONTEXT, NULL);
+	EGL_ASSERT(egl->context != EGL_NO_CONTEXT);
+
+	if (surfaceless) {
+		egl->surface = EGL_NO_SURFACE;
+	} else {
+		// we render into an FBO; the pbuffer only exists to make the
+		// context current
+		EGLint pbuffer_attrs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		egl->surface = eglCreatePbufferSurface(egl->display, config, pbuffer_attrs);
+		EGL_ASSERT(egl->surface != EGL_NO_SURFACE);
+	}
+
+	EGL_ASSERT(eglMakeCurrent(egl->display, egl->surface, egl->surface, egl->context));
+}
+
+static void headless_egl_free(struct headless_egl* egl)
+{
+	eglMakeCurrent(egl->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (egl->surface != EGL_NO_SURFACE) eglDestroySurface(egl->display, egl->surface);
+	eglDestroyContext(egl->display, egl->context);
+	eglTerminate(egl->display);
+}
+
+// orbits the first chunk once over the run, looking along the path
+static void headless_camera(struct lvl* lvl, int frame, int n_frames, struct lvl_entity* e)
+{
+	struct lvl_chunk* chunk = lvl_get_chunk(lvl, 0);
+	float t = (float)frame / (float)n_frames;
+	float theta = I2RAD(t);
+	union vec3 offset = {{
+		cosf(theta) * chunk->aabb.extent.x * 0.6f,
+		0,
+		sinf(theta) * chunk->aabb.extent.z * 0.6f
+	}};
+	e->position = vec3_add(chunk->aabb.center, offset);
+	e->yaw = t * 360.0f + 180.0f;
+	e->pitch = sinf(theta * 2) * 10.0f;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+	double da = *(const double*)a;
+	double db = *(const double*)b;
+	return (da > db) - (da < db);
+}
+
+static void report(const char* what, double* samples, int n)
+{
+	if (n == 0) {
+		printf("%s frame ms: n/a\n", what);
+		return;
+	}
+	double sum = 0;
+	for (int i = 0; i < n; i++) sum += samples[i];
+	qsort(samples, n, sizeof(*samples), compare_doubles);
+	int p99_index = (int)(0.99 * (double)(n - 1) + 0.5);
+	printf("%s frame ms: mean %.3f p99 %.3f\n", what, sum / (double)n, samples[p99_index]);
+}
+
+void headless_options_default(struct headless_options* opts)
+{
+	memset(opts, 0, sizeof(*opts));
+	opts->plan = "thing";
+	opts->n_frames = 600;
+	opts->width = 1280;
+	opts->height = 720;
+}
+
+int headless_run(struct headless_options* opts)
+{
+	struct demo demo;
+	const char* plan = opts->plan;
+	int n_frames = opts->n_frames;
+	if (opts->replay) {
+		demo_load(&demo, opts->replay);
+		plan = demo.plan;
+		n_frames = demo.n_ticks;
+	}
+	ASSERT(n_frames > 0);
+
+	struct headless_egl egl;
+	headless_egl_init(&egl);
+
+	struct render render;
+	render_init_offscreen(&render, opts->width, opts->height);
+
+	struct lvl lvl;
+	struct llvl_build_stats build_stats;
+	llvl_build(plan, &lvl, &build_stats);
+	render_set_lvl(&render, &lvl);
+
+	prof_init(1);
+	frame_init(1<<20);
+	int frame_zone = -1;
+
+	double* cpu_ms = calloc(n_frames, sizeof(*cpu_ms));
+	double* gpu_ms = calloc(n_frames, sizeof(*gpu_ms));
+	AN(cpu_ms);
+	AN(gpu_ms);
+	int n_gpu_ms = 0;
+
+	uint8_t* pixels = NULL;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	if (opts->frame_hash) AN(pixels = malloc(opts->width * opts->height * 4));
+
+	struct lvl_entity camera;
+	memset(&camera, 0, sizeof(camera));
+	int n_mismatches = 0;
+
+	// keep going past n_frames until the GPU times of all n_frames frames
+	// have been read back
+	for (int frame = 0; frame < (n_frames + PROF_GPU_LATENCY); frame++) {
+		frame_begin();
+		prof_frame_begin();
+		if (opts->replay == NULL) {
+			headless_camera(&lvl, frame, n_frames, &camera);
+		} else if (frame < n_frames) {
+			struct demo_tick* tick = &demo.ticks[frame];
+			prof_begin("sim");
+			demo_apply_input(&camera, &tick->input);
+			lvl_entity_update(&lvl, &camera, demo.dt);
+			prof_end();
+			uint32_t entity_hash = demo_entity_hash(&camera);
+			if (entity_hash != tick->hash) {
+				if (n_mismatches == 0) {
+					printf("replay: diverged at tick %d (entity hash %08x, recorded %08x)\n", frame, entity_hash, tick->hash);
+				}
+				n_mismatches++;
+			}
+		}
+		render_lvl(&render, &lvl, &camera);
+		prof_begin("swap");
+		render_flip(&render);
+		prof_end();
+		prof_frame_end();
+		counters_frame_end();
+		frame_end();
+		trace_flush_if_full();
+
+		if (frame_zone < 0) frame_zone = prof_find_zone("frame");
+		struct prof_zone* zone = prof_get_zone(frame_zone);
+
+		if (frame < n_frames) {
+			cpu_ms[frame] = zone->cpu_ms;
+
+			if (pixels) {
+				render_read_pixels(&render, pixels);
+				for (int i = 0; i < opts->width * opts->height * 4; i++) {
+					hash ^= pixels[i];
+					hash *= 0x100000001b3ULL;
+				}
+			}
+		}
+
+		int64_t gpu_frame = prof_gpu_frame_number();
+		if (prof_has_gpu() && gpu_frame >= 0 && gpu_frame < n_frames && gpu_frame == n_gpu_ms) {
+			gpu_ms[n_gpu_ms++] = zone->gpu_ms;
+		}
+	}
+
+	printf("headless: plan %s, %d frames at %dx%d, %s\n", plan, n_frames, opts->width, opts->height, (const char*)glGetString(GL_RENDERER));
+	report("cpu", cpu_ms, n_frames);
+	report("gpu", gpu_ms, n_gpu_ms);
+	if (pixels) printf("frame hash: %016llx\n", (unsigned long long)hash);
+	scratch_dump_stats(stdout, "lvl", &lvl.scratch);
+	llvl_dump_build_stats(stdout, &build_stats);
+	counters_dump(stdout);
+	if (opts->replay) printf("replay: %d ticks, %d diverged\n", n_frames, n_mismatches);
+
+	free(pixels);
+	free(cpu_ms);
+	free(gpu_ms);
+
+	frame_free();
+	prof_free();
+	render_set_lvl(&render, NULL);
+	lvl_free(&lvl);
+	headless_egl_free(&egl);
+	if (opts->replay) demo_free(&demo);
+
+	return n_mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
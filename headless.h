@@ -0,0 +1,27 @@
+#ifndef HEADLESS_H
+
+/*
+headless benchmark: renders a level into an offscreen framebuffer through an
+EGL context (surfaceless if possible, pbuffer otherwise; both work on Mesa
+llvmpipe), flying a scripted camera path for a fixed number of frames
+without vsync, then reports CPU and GPU frame times.
+
+with a replay (see demo.h), the camera is instead driven through the sim by
+the recorded inputs, one tick per frame, on the recorded plan; every tick's
+entity state is checked against the recording, and any divergence makes
+the run fail.
+*/
+
+struct headless_options {
+	const char* plan;
+	int n_frames;
+	int width, height;
+	int frame_hash; // hash every frame's pixels (slow; skews timings)
+	const char* replay; // demo path, or NULL for the scripted camera
+};
+
+void headless_options_default(struct headless_options* opts);
+int headless_run(struct headless_options* opts);
+
+#define HEADLESS_H
+#endif
@@ -0,0 +1,319 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "a.h"
+#include "job.h"
+#include "trace.h"
+
+/*
+Chase-Lev deque; the owner pushes and pops at the bottom, thieves take from
+the top. top and bottom live in separate cache lines so that thieves
+polling top don't keep invalidating the owner's bottom.
+*/
+struct job_deque {
+	int64_t top;
+	char pad0[64 - sizeof(int64_t)];
+	int64_t bottom;
+	char pad1[64 - sizeof(int64_t)];
+	struct job jobs[JOB_DEQUE_SIZE];
+};
+
+static struct {
+	int initialized;
+	int n_workers;
+	pthread_t threads[JOB_MAX_WORKERS];
+	struct job_deque* deques;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int n_sleeping;
+	int n_pending; // jobs in deques and queue, not yet taken
+	int quit;
+
+	// shared queue for non-worker threads; guarded by mutex
+	int n_queued;
+	int queue_head;
+	struct job queue[JOB_QUEUE_SIZE];
+} job;
+
+static __thread int job_tls_worker = -1;
+
+static void job_load(struct job* dst, struct job* src)
+{
+	// a thief may read a slot the owner is overwriting, in which case its
+	// CAS on top fails and the (torn) job is discarded; keep reads atomic
+	// per field regardless
+	dst->fn = __atomic_load_n(&src->fn, __ATOMIC_RELAXED);
+	dst->arg = __atomic_load_n(&src->arg, __ATOMIC_RELAXED);
+	dst->counter = __atomic_load_n(&src->counter, __ATOMIC_RELAXED);
+}
+
+static void job_store(struct job* dst, struct job* src)
+{
+	__atomic_store_n(&dst->fn, src->fn, __ATOMIC_RELAXED);
+	__atomic_store_n(&dst->arg, src->arg, __ATOMIC_RELAXED);
+	__atomic_store_n(&dst->counter, src->counter, __ATOMIC_RELAXED);
+}
+
+static int job_deque_push(struct job_deque* d, struct job* j)
+{
+	int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+	int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	if ((b - t) >= (JOB_DEQUE_SIZE - 1)) return 0; // full
+	job_store(&d->jobs[b & (JOB_DEQUE_SIZE - 1)], j);
+	__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static int job_deque_pop(struct job_deque* d, struct job* j)
+{
+	int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+	if (t > b) {
+		// empty
+		__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	job_load(j, &d->jobs[b & (JOB_DEQUE_SIZE - 1)]);
+	if (t < b) return 1;
+
+	// last job; race thieves for it
+	int won = __atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+	__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+	return won;
+}
+
+static int job_deque_steal(struct job_deque* d, struct job* j)
+{
+	int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b) return 0;
+	job_load(j, &d->jobs[t & (JOB_DEQUE_SIZE - 1)]);
+	return __atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static int job_queue_pop(struct job* j)
+{
+	if (__atomic_load_n(&job.n_queued, __ATOMIC_ACQUIRE) == 0) return 0;
+	int got = 0;
+	pthread_mutex_lock(&job.mutex);
+	if (job.n_queued > 0) {
+		*j = job.queue[job.queue_head];
+		job.queue_head = (job.queue_head + 1) & (JOB_QUEUE_SIZE - 1);
+		__atomic_sub_fetch(&job.n_queued, 1, __ATOMIC_RELEASE);
+		got = 1;
+	}
+	pthread_mutex_unlock(&job.mutex);
+	return got;
+}
+
+static int job_queue_push(struct job* j)
+{
+	int ok = 0;
+	pthread_mutex_lock(&job.mutex);
+	if (job.n_queued < JOB_QUEUE_SIZE) {
+		job.queue[(job.queue_head + job.n_queued) & (JOB_QUEUE_SIZE - 1)] = *j;
+		__atomic_add_fetch(&job.n_queued, 1, __ATOMIC_RELEASE);
+		ok = 1;
+	}
+	pthread_mutex_unlock(&job.mutex);
+	return ok;
+}
+
+static int job_take(struct job* j)
+{
+	if (!job.initialized) return 0;
+
+	int self = job_tls_worker;
+	int got = 0;
+	if (self >= 0) got = job_deque_pop(&job.deques[self], j);
+	if (!got) got = job_queue_pop(j);
+	for (int i = 1; !got && i <= job.n_workers; i++) {
+		int victim = ((self < 0 ? 0 : self) + i) % job.n_workers;
+		if (victim == self) continue;
+		got = job_deque_steal(&job.deques[victim], j);
+	}
+
+	if (got) __atomic_sub_fetch(&job.n_pending, 1, __ATOMIC_SEQ_CST);
+	return got;
+}
+
+static void job_run(struct job* j)
+{
+	TRACE_BEGIN("job");
+	j->fn(j->arg);
+	TRACE_END("job");
+	__atomic_sub_fetch(&j->counter->value, 1, __ATOMIC_RELEASE);
+}
+
+static void* job_worker_main(void* usr)
+{
+	job_tls_worker = (int)(intptr_t)usr;
+	TRACE_THREAD_NAME("worker");
+	for (;;) {
+		struct job j;
+		if (job_take(&j)) {
+			job_run(&j);
+			continue;
+		}
+
+		// n_sleeping and n_pending are both seq_cst, so either we see a
+		// submitter's n_pending increment here, or it sees our n_sleeping
+		// increment and signals (under the mutex we hold until cond_wait)
+		pthread_mutex_lock(&job.mutex);
+		__atomic_add_fetch(&job.n_sleeping, 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&job.n_pending, __ATOMIC_SEQ_CST) <= 0 && !job.quit) {
+			pthread_cond_wait(&job.cond, &job.mutex);
+		}
+		__atomic_sub_fetch(&job.n_sleeping, 1, __ATOMIC_SEQ_CST);
+		int quit = job.quit;
+		pthread_mutex_unlock(&job.mutex);
+		if (quit) break;
+	}
+	return NULL;
+}
+
+void job_init(int n_threads)
+{
+	ASSERT(!job.initialized);
+	if (n_threads < 0) n_threads = 0;
+	if (n_threads > (JOB_MAX_WORKERS - 1)) n_threads = JOB_MAX_WORKERS - 1;
+
+	memset(&job, 0, sizeof(job));
+	job.n_workers = n_threads + 1;
+	AN(job.deques = calloc(job.n_workers, sizeof(*job.deques)));
+	AZ(pthread_mutex_init(&job.mutex, NULL));
+	AZ(pthread_cond_init(&job.cond, NULL));
+	job.initialized = 1;
+
+	job_tls_worker = 0;
+	for (int i = 1; i < job.n_workers; i++) {
+		AZ(pthread_create(&job.threads[i], NULL, job_worker_main, (void*)(intptr_t)i));
+	}
+}
+
+void job_free()
+{
+	ASSERT(job.initialized);
+	ASSERT(job_tls_worker == 0);
+
+	pthread_mutex_lock(&job.mutex);
+	job.quit = 1;
+	pthread_cond_broadcast(&job.cond);
+	pthread_mutex_unlock(&job.mutex);
+	for (int i = 1; i < job.n_workers; i++) AZ(pthread_join(job.threads[i], NULL));
+
+	AZ(job.n_pending);
+	pthread_cond_destroy(&job.cond);
+	pthread_mutex_destroy(&job.mutex);
+	free(job.deques);
+	memset(&job, 0, sizeof(job));
+	job_tls_worker = -1;
+}
+
+int job_n_workers()
+{
+	return job.initialized ? job.n_workers : 1;
+}
+
+int job_worker_index()
+{
+	return job_tls_worker;
+}
+
+void job_submit(struct job_counter* counter, job_fn fn, void* arg)
+{
+	AN(counter);
+	struct job j;
+	j.fn = fn;
+	j.arg = arg;
+	j.counter = counter;
+	__atomic_add_fetch(&counter->value, 1, __ATOMIC_RELAXED);
+
+	int self = job_tls_worker;
+	int queued = 0;
+	if (job.initialized) {
+		queued = self >= 0 ? job_deque_push(&job.deques[self], &j) : job_queue_push(&j);
+	}
+	if (!queued) {
+		// not initialized or out of space
+		job_run(&j);
+		return;
+	}
+
+	__atomic_add_fetch(&job.n_pending, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&job.n_sleeping, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&job.mutex);
+		pthread_cond_signal(&job.cond);
+		pthread_mutex_unlock(&job.mutex);
+	}
+}
+
+void job_wait(struct job_counter* counter)
+{
+	AN(counter);
+	while (__atomic_load_n(&counter->value, __ATOMIC_ACQUIRE) > 0) {
+		struct job j;
+		if (job_take(&j)) {
+			job_run(&j);
+		} else {
+			// remaining jobs are running on other threads
+			sched_yield();
+		}
+	}
+}
+
+struct job_parallel_for {
+	job_range_fn fn;
+	void* arg;
+	int n;
+	int batch_size;
+	int next;
+};
+
+static void job_parallel_for_job(void* usr)
+{
+	struct job_parallel_for* pf = usr;
+	for (;;) {
+		int begin = __atomic_fetch_add(&pf->next, pf->batch_size, __ATOMIC_RELAXED);
+		if (begin >= pf->n) break;
+		int end = begin + pf->batch_size;
+		if (end > pf->n) end = pf->n;
+		pf->fn(pf->arg, begin, end);
+	}
+}
+
+void job_parallel_for(int n, int batch_size, job_range_fn fn, void* arg)
+{
+	ASSERT(batch_size > 0);
+	if (n <= 0) return;
+
+	struct job_parallel_for pf;
+	pf.fn = fn;
+	pf.arg = arg;
+	pf.n = n;
+	pf.batch_size = batch_size;
+	pf.next = 0;
+
+	// rather than one job per batch, one job per worker, each grabbing
+	// batches until there are none left; the caller takes part as well
+	int n_batches = (n + batch_size - 1) / batch_size;
+	int n_jobs = job_n_workers();
+	if (n_jobs > n_batches) n_jobs = n_batches;
+
+	struct job_counter counter;
+	counter.value = 0;
+	for (int i = 1; i < n_jobs; i++) job_submit(&counter, job_parallel_for_job, &pf);
+	job_parallel_for_job(&pf);
+	job_wait(&counter);
+}
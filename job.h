@@ -0,0 +1,51 @@
+#ifndef JOB_H
+
+/*
+work-stealing job system. job_init() starts n_threads worker threads; the
+thread calling job_init() is worker 0 and runs jobs whenever it waits in
+job_wait(). each worker has its own deque: it pushes and pops at the
+bottom, idle workers steal from the top of the others. threads that aren't
+workers (e.g. a loader thread) submit through a shared, locked queue.
+
+jobs are tracked by counters: job_submit() increments the counter, and it
+is decremented when the job has run. job_wait() runs other jobs until the
+counter reaches zero, so a job may itself submit jobs and wait for them;
+that's also how dependencies are expressed. counters must outlive the
+jobs referencing them, and a counter should be waited on by one thread.
+
+without job_init() jobs simply run inline in job_submit(), so callers need
+no special casing.
+*/
+
+#define JOB_MAX_WORKERS (64)
+#define JOB_DEQUE_SIZE (4096) // power of two
+#define JOB_QUEUE_SIZE (4096) // shared queue for non-worker threads
+
+typedef void (*job_fn)(void* arg);
+
+struct job_counter {
+	int value;
+};
+
+struct job {
+	job_fn fn;
+	void* arg;
+	struct job_counter* counter;
+};
+
+void job_init(int n_threads);
+void job_free();
+
+int job_n_workers(); // including worker 0; 1 without job_init()
+int job_worker_index(); // -1 for non-worker threads
+
+void job_submit(struct job_counter* counter, job_fn fn, void* arg);
+void job_wait(struct job_counter* counter);
+
+// calls fn(arg, begin, end) over [0;n) in batches of batch_size elements,
+// in parallel, and returns when all batches are done
+typedef void (*job_range_fn)(void* arg, int begin, int end);
+void job_parallel_for(int n, int batch_size, job_range_fn fn, void* arg);
+
+#define JOB_H
+#endif
@@ -0,0 +1,35 @@
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "lcounters.h"
+#include "counters.h"
+
+static int push_counters(lua_State* L, int64_t (*get)(enum counter))
+{
+	lua_createtable(L, 0, COUNTER_MAX);
+	for (int i = 0; i < COUNTER_MAX; i++) {
+		lua_pushinteger(L, get(i));
+		lua_setfield(L, -2, counters_name(i));
+	}
+	return 1;
+}
+
+static int l_frame(lua_State* L)
+{
+	return push_counters(L, counters_get_frame);
+}
+
+static int l_total(lua_State* L)
+{
+	return push_counters(L, counters_get_total);
+}
+
+void lcounters_open(lua_State* L)
+{
+	lua_createtable(L, 0, 2);
+	lua_pushcfunction(L, l_frame);
+	lua_setfield(L, -2, "frame");
+	lua_pushcfunction(L, l_total);
+	lua_setfield(L, -2, "total");
+	lua_setglobal(L, "counters");
+}
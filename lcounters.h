@@ -0,0 +1,10 @@
+#ifndef LCOUNTERS_H
+
+#include <lua.h>
+
+// sets global `counters` with frame() and total(), each returning a table
+// of counter name to value (see counters.h)
+void lcounters_open(lua_State* L);
+
+#define LCOUNTERS_H
+#endif
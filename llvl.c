@@ -1,10 +1,23 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
 #include <lua.h>
 #include <lauxlib.h>
 #include <lualib.h>
 
 #include "llvl.h"
+#include "lpool.h"
+#include "prof.h"
 
 #include "a.h"
+#include "platform.h"
+#include "trace.h"
+#include "lcounters.h"
 
 static void setup_package_path(lua_State* L)
 {
@@ -16,32 +29,248 @@ static void setup_package_path(lua_State* L)
 	lua_pop(L, 1);
 }
 
-static void pcall(lua_State* L, int nargs, int nresults)
+/*
+bytecode cache: source files loaded through load_cached() are compiled once
+and their lua_dump() output is stored in LLVL_CACHE_DIR, keyed by path. a
+cached chunk is used as long as the source file's mtime (with nanoseconds,
+where the platform has them) and size match those recorded in the cache
+file header; otherwise the source is parsed and the cache file rewritten.
+*/
+
+struct bytecode_cache_header {
+	char magic[8];
+	int64_t mtime;
+	int64_t mtime_nsec;
+	int64_t size;
+};
+
+static const char bytecode_cache_magic[8] = "FMTPLUC2";
+
+static void bytecode_cache_path(const char* src_path, char* path, size_t sz)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (const char* p = src_path; *p; p++) {
+		hash ^= (uint8_t)*p;
+		hash *= 0x100000001b3ULL;
+	}
+	snprintf(path, sz, "%s/lua-%016llx.luac", LLVL_CACHE_DIR, (unsigned long long)hash);
+}
+
+struct dump_buffer {
+	char* data;
+	size_t size;
+	size_t cap;
+};
+
+static int dump_writer(lua_State* L, const void* p, size_t sz, void* ud)
+{
+	struct dump_buffer* buf = ud;
+	if (buf->size + sz > buf->cap) {
+		size_t cap = buf->cap ? buf->cap : 4096;
+		while (cap < buf->size + sz) cap <<= 1;
+		char* data = realloc(buf->data, cap);
+		if (data == NULL) return 1;
+		buf->data = data;
+		buf->cap = cap;
+	}
+	memcpy(buf->data + buf->size, p, sz);
+	buf->size += sz;
+	return 0;
+}
+
+static void bytecode_cache_save(lua_State* L, const char* path, struct bytecode_cache_header* header)
+{
+	struct dump_buffer buf;
+	memset(&buf, 0, sizeof(buf));
+	// keep debug info; plan errors should still point at source lines
+	if (lua_dump(L, dump_writer, &buf, 0) != 0) {
+		free(buf.data);
+		return;
+	}
+
+	platform_mkdir(LLVL_CACHE_DIR);
+
+	// write to a temporary file and rename, so that a concurrent build
+	// never sees a half-written chunk
+	char tmppath[1040];
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	FILE* f = fopen(tmppath, "wb");
+	if (f != NULL) {
+		int ok = fwrite(header, sizeof(*header), 1, f) == 1 && fwrite(buf.data, buf.size, 1, f) == 1;
+		ok = (fclose(f) == 0) && ok;
+		if (!ok || rename(tmppath, path) != 0) remove(tmppath);
+	}
+
+	free(buf.data);
+}
+
+static int bytecode_cache_load(lua_State* L, const char* src_path, const char* path, struct bytecode_cache_header* expected)
+{
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) return 0;
+
+	int ok = 0;
+	char* data = NULL;
+	struct bytecode_cache_header header;
+	if (fread(&header, sizeof(header), 1, f) != 1) goto done;
+	if (memcmp(&header, expected, sizeof(header)) != 0) goto done;
+
+	if (fseek(f, 0, SEEK_END) != 0) goto done;
+	long end = ftell(f);
+	if (end <= (long)sizeof(header)) goto done;
+	size_t sz = end - sizeof(header);
+	if (fseek(f, sizeof(header), SEEK_SET) != 0) goto done;
+	AN(data = malloc(sz));
+	if (fread(data, sz, 1, f) != 1) goto done;
+
+	// lua_load() checks the version/format header of the chunk itself, so
+	// chunks dumped by a different Lua build are rejected here
+	char chunkname[1040];
+	snprintf(chunkname, sizeof(chunkname), "@%s", src_path);
+	if (luaL_loadbufferx(L, data, sz, chunkname, "b") == LUA_OK) {
+		ok = 1;
+	} else {
+		lua_pop(L, 1);
+	}
+
+done:
+	free(data);
+	fclose(f);
+	return ok;
+}
+
+// like luaL_loadfilex(L, path, "t"), but goes through the bytecode cache
+static int load_cached(lua_State* L, const char* src_path, struct llvl_build_stats* stats)
+{
+	struct stat st;
+	if (stat(src_path, &st) != 0) {
+		// let luaL_loadfilex() produce the error message
+		return luaL_loadfilex(L, src_path, "t");
+	}
+
+	struct bytecode_cache_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, bytecode_cache_magic, sizeof(header.magic));
+	header.mtime = st.st_mtime;
+	header.mtime_nsec = platform_stat_mtime_nsec(&st);
+	header.size = st.st_size;
+
+	char path[1024];
+	bytecode_cache_path(src_path, path, sizeof(path));
+
+	if (bytecode_cache_load(L, src_path, path, &header)) {
+		stats->n_chunks_cached++;
+		return LUA_OK;
+	}
+
+	int status = luaL_loadfilex(L, src_path, "t");
+	if (status != LUA_OK) return status;
+	stats->n_chunks_compiled++;
+	bytecode_cache_save(L, path, &header);
+	return LUA_OK;
+}
+
+// loadfile_cached(path): same contract as loadfile(path)
+static int l_loadfile_cached(lua_State* L)
+{
+	const char* path = luaL_checkstring(L, 1);
+	struct llvl_build_stats* stats = lua_touserdata(L, lua_upvalueindex(1));
+	if (load_cached(L, path, stats) != LUA_OK) {
+		lua_pushnil(L);
+		lua_insert(L, -2);
+		return 2;
+	}
+	return 1;
+}
+
+// package.searchers entry that resolves modules like the stock Lua searcher,
+// but loads them through the bytecode cache
+static int l_searcher_cached(lua_State* L)
+{
+	const char* name = luaL_checkstring(L, 1);
+	struct llvl_build_stats* stats = lua_touserdata(L, lua_upvalueindex(1));
+
+	lua_getglobal(L, "package");
+	lua_getfield(L, -1, "searchpath");
+	lua_pushstring(L, name);
+	lua_getfield(L, -3, "path");
+	lua_call(L, 2, 2);
+	if (lua_isnil(L, -2)) return 1; // error message from searchpath
+
+	const char* path = lua_tostring(L, -2);
+	if (load_cached(L, path, stats) != LUA_OK) {
+		return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s", name, path, lua_tostring(L, -1));
+	}
+	lua_pushstring(L, path);
+	return 2;
+}
+
+static void setup_bytecode_cache(lua_State* L, struct llvl_build_stats* stats)
+{
+	lua_pushlightuserdata(L, stats);
+	lua_pushcclosure(L, l_loadfile_cached, 1);
+	lua_setglobal(L, "loadfile_cached");
+
+	// insert before the stock Lua searcher (index 2, after preload)
+	lua_getglobal(L, "package");
+	lua_getfield(L, -1, "searchers");
+	int n = lua_rawlen(L, -1);
+	for (int i = n; i >= 2; i--) {
+		lua_rawgeti(L, -1, i);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_pushlightuserdata(L, stats);
+	lua_pushcclosure(L, l_searcher_cached, 1);
+	lua_rawseti(L, -2, 2);
+	lua_pop(L, 2);
+}
+
+static int is_cancelled_flag(int* cancel)
+{
+	return cancel != NULL && __atomic_load_n(cancel, __ATOMIC_ACQUIRE);
+}
+
+static int is_cancelled(lua_State* L)
+{
+	lua_getfield(L, LUA_REGISTRYINDEX, "llvl_cancel");
+	int* cancel = lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	return is_cancelled_flag(cancel);
+}
+
+static void cancel_hook(lua_State* L, lua_Debug* ar)
+{
+	if (is_cancelled(L)) luaL_error(L, "build cancelled");
+}
+
+/*
+returns LLVL_LOAD_DONE, LLVL_LOAD_CANCELLED if the build was cancelled, or
+LLVL_LOAD_FAILED with the message in error (error_size bytes). without an
+error buffer, errors are fatal
+*/
+static int pcall(lua_State* L, int nargs, int nresults, char* error, size_t error_size)
 {
 	int status = lua_pcall(L, nargs, nresults, 0);
-	if (status != 0) {
-		const char* err = lua_tostring(L, -1);
-		switch (status) {
-			case LUA_ERRRUN:
-				arghf("(lua runtime error) %s", err);
-				break;
-			case LUA_ERRMEM:
-				arghf("(lua memory error) %s", err);
-				break;
-			case LUA_ERRERR:
-				arghf("(lua error handler error) %s", err);
-				break;
-			default:
-				arghf("(lua unknown error) %s", err);
-				break;
-		}
+	if (status == 0) return LLVL_LOAD_DONE;
+	if (is_cancelled(L)) return LLVL_LOAD_CANCELLED;
+
+	const char* kind;
+	switch (status) {
+		case LUA_ERRRUN: kind = "lua runtime error"; break;
+		case LUA_ERRMEM: kind = "lua memory error"; break;
+		case LUA_ERRERR: kind = "lua error handler error"; break;
+		default: kind = "lua unknown error"; break;
 	}
+	const char* err = lua_tostring(L, -1);
+	if (error == NULL) arghf("(%s) %s", kind, err);
+	snprintf(error, error_size, "(%s) %s", kind, err);
+	return LLVL_LOAD_FAILED;
 }
 
 static int table_length(lua_State* L, const char* field)
 {
 	lua_getfield(L, -1, field);
-	if (!lua_istable(L, -1)) arghf("\"%s\" is not a table", field);
+	if (!lua_istable(L, -1)) luaL_error(L, "\"%s\" is not a table", field);
 	int length = lua_rawlen(L, -1);
 	lua_pop(L, 1);
 	return length;
@@ -67,56 +296,126 @@ static void populate_vec3(lua_State* L, union vec3* v)
 	lua_pop(L, 1);
 }
 
-static void populate_lvl(lua_State* L, struct lvl* lvl)
+// 16 numbers, row major (as exported by export_lump.py)
+static void populate_mat44(lua_State* L, struct mat44* m)
+{
+	for (int row = 0; row < 4; row++) {
+		for (int col = 0; col < 4; col++) {
+			lua_rawgeti(L, -1, row*4 + col + 1);
+			*(mat44_atp(m, col, row)) = (float)lua_tonumber(L, -1);
+			lua_pop(L, 1);
+		}
+	}
+	lua_pop(L, 1);
+}
+
+static void populate_vertices(lua_State* L, struct lvl_vertex* vertices, int n_vertices)
+{
+	lua_getfield(L, -1, "vertices");
+	for (int j = 0; j < n_vertices; j++) {
+		lua_rawgeti(L, -1, j+1);
+		struct lvl_vertex* vertex = &vertices[j];
+
+		lua_getfield(L, -1, "co");
+		populate_vec3(L, &vertex->co);
+
+		lua_getfield(L, -1, "uv");
+		populate_vec2(L, &vertex->uv);
+
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+}
+
+static void populate_vertex_pair(lua_State* L, uint32_t* pair)
+{
+	for (int i = 0; i < 2; i++) {
+		lua_rawgeti(L, -1, i+1);
+		pair[i] = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+}
+
+static void populate_polygon_list(lua_State* L, uint32_t* polygon_list, int polygon_list_size)
+{
+	lua_getfield(L, -1, "polygon_list");
+	for (int j = 0; j < polygon_list_size; j++) {
+		lua_rawgeti(L, -1, j+1);
+		polygon_list[j] = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+}
+
+/*
+pops the compiled level table and builds lvl from it. malformed or invalid
+levels raise lua errors, so call it protected (see l_populate_lvl()); lvl
+is initialized once the table's sizes have been read, and is left
+incomplete on errors. checks cancel (may be NULL) between chunks and
+meshes, and passes it on to lvl_build_pvs(); if cancelled, returns 0 with
+lvl likewise incomplete. either way the lua stack is left unbalanced (the
+state is about to be closed anyway)
+*/
+static int populate_lvl(lua_State* L, struct lvl* lvl, int* cancel)
 {
 	char errstr1024[1024];
 
-	if (!lua_istable(L, -1)) arghf("expected a table");
+	if (!lua_istable(L, -1)) luaL_error(L, "expected a table");
 
 	int n_chunks = table_length(L, "chunks");
 	int n_portals = table_length(L, "portals");
 	int n_materials = table_length(L, "materials");
+	int n_meshes = table_length(L, "meshes");
 
-	lvl_init(lvl, n_chunks, n_portals, n_materials);
+	lvl_init(lvl, n_chunks, n_portals, n_materials, n_meshes);
 
 	{
 		lua_getfield(L, -1, "chunks");
 		for (int i = 0; i < n_chunks; i++) {
+			if (is_cancelled_flag(cancel)) goto cancelled;
 			lua_rawgeti(L, -1, i+1);
 			int n_vertices = table_length(L, "vertices");
 			int polygon_list_size = table_length(L, "polygon_list");
 			int n_portal_indices = table_length(L, "portal_indices");
-			struct lvl_chunk* chunk = lvl_init_chunk(lvl, i, n_vertices, polygon_list_size, n_portal_indices);
-
-			// vertices
-			lua_getfield(L, -1, "vertices");
-			for (int j = 0; j < n_vertices; j++) {
-				lua_rawgeti(L, -1, j+1);
-				struct lvl_vertex* vertex = &chunk->vertices[j];
-
-				lua_getfield(L, -1, "co");
-				populate_vec3(L, &vertex->co);
+			int n_instances = table_length(L, "instances");
+			struct lvl_chunk* chunk = lvl_init_chunk(lvl, i, n_vertices, polygon_list_size, n_portal_indices, n_instances);
 
-				lua_getfield(L, -1, "uv");
-				populate_vec2(L, &vertex->uv);
+			populate_vertices(L, chunk->vertices, n_vertices);
+			populate_polygon_list(L, chunk->polygon_list, polygon_list_size);
 
-				lua_pop(L, 1);
+			{
+				int err = lvl_chunk_validate_polygon_list(lvl, chunk, n_vertices, polygon_list_size, errstr1024);
+				if (err) luaL_error(L, "lvl_chunk_validate_polygon_list: %s (%d)", errstr1024, err);
 			}
-			lua_pop(L, 1);
 
-			// polygon list
-			lua_getfield(L, -1, "polygon_list");
-			for (int j = 0; j < polygon_list_size; j++) {
-				lua_rawgeti(L, -1, j+1);
-				chunk->polygon_list[j] = lua_tointeger(L, -1);
+			// collision mesh
+			lua_getfield(L, -1, "collision");
+			if (lua_istable(L, -1)) {
+				int n_collision_vertices = table_length(L, "vertices");
+				int collision_polygon_list_size = table_length(L, "polygon_list");
+				lvl_init_chunk_collision(lvl, i, n_collision_vertices, collision_polygon_list_size);
+
+				lua_getfield(L, -1, "vertices");
+				for (int j = 0; j < n_collision_vertices; j++) {
+					lua_rawgeti(L, -1, j+1);
+					populate_vec3(L, &chunk->collision_vertices[j]);
+				}
 				lua_pop(L, 1);
+
+				populate_polygon_list(L, chunk->collision_polygon_list, collision_polygon_list_size);
+
+				int err = lvl_chunk_validate_collision_polygon_list(lvl, chunk, n_collision_vertices, collision_polygon_list_size, errstr1024);
+				if (err) luaL_error(L, "lvl_chunk_validate_collision_polygon_list: %s (%d)", errstr1024, err);
+			} else {
+				// render polygons have no size limit; collision polygons do
+				lvl_chunk_collision_from_render(lvl, i);
+				int err = lvl_chunk_validate_collision_polygon_list(lvl, chunk, n_vertices, polygon_list_size, errstr1024);
+				if (err) luaL_error(L, "lvl_chunk_validate_collision_polygon_list: render polygons used for collision: %s (%d)", errstr1024, err);
 			}
 			lua_pop(L, 1);
 
-			{
-				int err = lvl_chunk_validate_polygon_list(lvl, chunk, n_vertices, polygon_list_size, errstr1024);
-				if (err) arghf("lvl_chunk_validate_polygon_list: %s (%d)", errstr1024, err);
-			}
+			lvl_chunk_finalize(lvl, chunk);
 
 			// portal indices
 			lua_getfield(L, -1, "portal_indices");
@@ -127,6 +426,23 @@ static void populate_lvl(lua_State* L, struct lvl* lvl)
 			}
 			lua_pop(L, 1);
 
+			// instances
+			lua_getfield(L, -1, "instances");
+			for (int j = 0; j < n_instances; j++) {
+				lua_rawgeti(L, -1, j+1);
+				struct lvl_instance* instance = &chunk->instances[j];
+
+				lua_getfield(L, -1, "mesh");
+				instance->mesh_index = lua_tointeger(L, -1);
+				lua_pop(L, 1);
+
+				lua_getfield(L, -1, "tx");
+				populate_mat44(L, &instance->transform);
+
+				lua_pop(L, 1);
+			}
+			lua_pop(L, 1);
+
 			lua_pop(L, 1); // chunks[i]
 		}
 		lua_pop(L, 1); // chunks
@@ -145,7 +461,7 @@ static void populate_lvl(lua_State* L, struct lvl* lvl)
 			// chunk indices
 			int n_chunk_indices = table_length(L, "chunk_indices");
 			if (n_chunk_indices != 2) {
-				arghf("portals[%d].chunk_indices must contain exactly 2 elements", i+1);
+				luaL_error(L, "portals[%d].chunk_indices must contain exactly 2 elements", i+1);
 			}
 			lua_getfield(L, -1, "chunk_indices");
 			for (int j = 0; j < 2; j++) {
@@ -156,22 +472,22 @@ static void populate_lvl(lua_State* L, struct lvl* lvl)
 			lua_pop(L, 1);
 
 
-			// vertex pairs
+			// vertex pairs; each is a {chunk_indices[0] vertex, chunk_indices[1] vertex} table
 			int offset = 0;
 
 			lua_getfield(L, -1, "convex_vertex_pairs");
 			for (int j = 0; j < n_convex_vertex_pairs; j++) {
 				lua_rawgeti(L, -1, j+1);
-				portal->vertex_pairs[offset++] = lua_tointeger(L, -1);
-				lua_pop(L, 1);
+				populate_vertex_pair(L, &portal->vertex_pairs[offset]);
+				offset += 2;
 			}
 			lua_pop(L, 1);
 
 			lua_getfield(L, -1, "additional_vertex_pairs");
 			for (int j = 0; j < n_additional_vertex_pairs; j++) {
 				lua_rawgeti(L, -1, j+1);
-				portal->vertex_pairs[offset++] = lua_tointeger(L, -1);
-				lua_pop(L, 1);
+				populate_vertex_pair(L, &portal->vertex_pairs[offset]);
+				offset += 2;
 			}
 			lua_pop(L, 1);
 
@@ -191,7 +507,7 @@ static void populate_lvl(lua_State* L, struct lvl* lvl)
 			size_t len;
 			const char* str = lua_tolstring(L, -1, &len);
 			if (len > (LVL_MATERIAL_NAME_MAX_LENGTH-1)) {
-				arghf("materials[%d].name length of %zd exceeds max length (%d)", i+1, len, LVL_MATERIAL_NAME_MAX_LENGTH-1);
+				luaL_error(L, "materials[%d].name length of %d exceeds max length (%d)", i+1, (int)len, LVL_MATERIAL_NAME_MAX_LENGTH-1);
 			}
 			strcpy(material->name, str);
 			lua_pop(L, 1);
@@ -201,30 +517,215 @@ static void populate_lvl(lua_State* L, struct lvl* lvl)
 		lua_pop(L, 1); // materials
 	}
 
+	{
+		lua_getfield(L, -1, "meshes");
+		for (int i = 0; i < n_meshes; i++) {
+			if (is_cancelled_flag(cancel)) goto cancelled;
+			lua_rawgeti(L, -1, i+1);
+			int n_vertices = table_length(L, "vertices");
+			int polygon_list_size = table_length(L, "polygon_list");
+			struct lvl_mesh* mesh = lvl_init_mesh(lvl, i, n_vertices, polygon_list_size);
+
+			populate_vertices(L, mesh->vertices, n_vertices);
+			populate_polygon_list(L, mesh->polygon_list, polygon_list_size);
+
+			{
+				int err = lvl_validate_polygon_list(lvl, mesh->polygon_list, n_vertices, polygon_list_size, errstr1024);
+				if (err) luaL_error(L, "lvl_validate_polygon_list: meshes[%d]: %s (%d)", i+1, errstr1024, err);
+			}
+
+			lvl_mesh_finalize(lvl, mesh);
+
+			lua_pop(L, 1); // meshes[i]
+		}
+		lua_pop(L, 1); // meshes
+	}
+
 	lua_pop(L, 1); // lvl
 
 	{
 		int err = lvl_validate_misc(lvl, errstr1024);
-		if (err) arghf("lvl_validate_misc: %s (%d)", errstr1024, err);
+		if (err) luaL_error(L, "lvl_validate_misc: %s (%d)", errstr1024, err);
+	}
+
+	if (!lvl_build_pvs(lvl, cancel)) goto cancelled;
+
+	return 1;
+
+cancelled:
+	return 0;
+}
+
+// populate_lvl(lvl, cancel, clvl) as a protected call; cancellation is
+// raised as an error too, which pcall() tells apart
+static int l_populate_lvl(lua_State* L)
+{
+	struct lvl* lvl = lua_touserdata(L, 1);
+	int* cancel = lua_touserdata(L, 2);
+	if (!populate_lvl(L, lvl, cancel)) return luaL_error(L, "build cancelled");
+	return 0;
+}
+
+static int table_int(lua_State* L, const char* field)
+{
+	lua_getfield(L, -1, field);
+	int value = lua_tointeger(L, -1);
+	lua_pop(L, 1);
+	return value;
+}
+
+// from the compiled lvl table on top of the stack
+static void populate_locality_stats(lua_State* L, struct llvl_build_stats* st)
+{
+	lua_getfield(L, -1, "locality");
+	if (lua_istable(L, -1)) {
+		st->n_triangles = table_int(L, "n_triangles");
+		st->vcache_misses_before = table_int(L, "vcache_misses_before");
+		st->vcache_misses_welded = table_int(L, "vcache_misses_welded");
+		st->vcache_misses_after = table_int(L, "vcache_misses_after");
+		st->n_vertices_before = table_int(L, "n_vertices_before");
+		st->n_vertices_after = table_int(L, "n_vertices_after");
 	}
+	lua_pop(L, 1);
 }
 
-void llvl_build(const char* plan_name, struct lvl* lvl)
+/*
+returns LLVL_LOAD_DONE, LLVL_LOAD_CANCELLED or LLVL_LOAD_FAILED (see pcall()
+for error); lvl is left uninitialized unless the build is done
+*/
+static int build(const char* plan_name, struct lvl* lvl, struct llvl_build_stats* stats, int* cancel, char* error, size_t error_size)
 {
-	lua_State* L = luaL_newstate();
+	TRACE_BEGIN("llvl_build");
+	uint64_t t0 = prof_ns();
+
+	struct llvl_build_stats st;
+	memset(&st, 0, sizeof(st));
+
+	// the build state is short-lived and allocation heavy; a pool makes
+	// its many small allocations cheap and its teardown a handful of
+	// free() calls
+	struct lpool pool;
+	lpool_init(&pool);
+
+	lua_State* L = lua_newstate(lpool_lua_alloc, &pool);
+	AN(L);
 	luaL_openlibs(L);
 	setup_package_path(L);
+	setup_bytecode_cache(L, &st);
+	lcounters_open(L);
+
+	if (cancel) {
+		lua_pushlightuserdata(L, cancel);
+		lua_setfield(L, LUA_REGISTRYINDEX, "llvl_cancel");
+		lua_sethook(L, cancel_hook, LUA_MASKCOUNT, 10000);
+	}
 
+	int result;
+
+	TRACE_BEGIN("llvl_build:require");
 	lua_getglobal(L, "require");
 	lua_pushstring(L, "build");
-	pcall(L, 1, 1);
-	if (!lua_isfunction(L, -1)) arghf("expected require('build') to yield a function");
-
-	lua_pushstring(L, plan_name);
-	pcall(L, 1, 1);
+	result = pcall(L, 1, 1, error, error_size);
+	TRACE_END("llvl_build:require");
+	if (result == LLVL_LOAD_DONE && !lua_isfunction(L, -1)) {
+		if (error == NULL) arghf("expected require('build') to yield a function");
+		snprintf(error, error_size, "expected require('build') to yield a function");
+		result = LLVL_LOAD_FAILED;
+	}
+	if (result == LLVL_LOAD_DONE) {
+		TRACE_BEGIN("llvl_build:plan");
+		lua_pushstring(L, plan_name);
+		result = pcall(L, 1, 1, error, error_size);
+		TRACE_END("llvl_build:plan");
+	}
 
-	populate_lvl(L, lvl);
+	if (result == LLVL_LOAD_DONE) {
+		populate_locality_stats(L, &st);
+		TRACE_BEGIN("populate_lvl");
+		memset(lvl, 0, sizeof(*lvl));
+		lua_pushcfunction(L, l_populate_lvl);
+		lua_insert(L, -2);
+		lua_pushlightuserdata(L, lvl);
+		lua_insert(L, -2);
+		lua_pushlightuserdata(L, cancel);
+		lua_insert(L, -2);
+		result = pcall(L, 3, 0, error, error_size);
+		TRACE_END("populate_lvl");
+		// lvl_init() runs early in populate_lvl(), but not before the
+		// first errors it may raise
+		if (result != LLVL_LOAD_DONE && lvl->scratch.first != NULL) lvl_free(lvl);
+	}
 
 	lua_close(L);
+
+	if (result == LLVL_LOAD_DONE && is_cancelled_flag(cancel)) {
+		lvl_free(lvl);
+		result = LLVL_LOAD_CANCELLED;
+	}
+
+	st.lua = pool.stats;
+	st.lua_bytes_reserved = scratch_get_stats(&pool.scratch).bytes_reserved;
+	st.build_ms = (double)(prof_ns() - t0) * 1e-6;
+	if (stats) *stats = st;
+
+	lpool_free(&pool);
+
+	TRACE_END("llvl_build");
+	return result;
+}
+
+void llvl_build(const char* plan_name, struct lvl* lvl, struct llvl_build_stats* stats)
+{
+	ASSERT(build(plan_name, lvl, stats, NULL, NULL, 0) == LLVL_LOAD_DONE);
+}
+
+static void* load_thread_main(void* usr)
+{
+	struct llvl_load* load = usr;
+	TRACE_THREAD_NAME("loader");
+	int result = build(load->plan, &load->lvl, &load->stats, &load->cancel, load->error, sizeof(load->error));
+	// publish; everything written by build() happens-before the state change
+	__atomic_store_n(&load->state, result, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+void llvl_load_start(struct llvl_load* load, const char* plan)
+{
+	ASSERT(__atomic_load_n(&load->state, __ATOMIC_ACQUIRE) == LLVL_LOAD_IDLE);
+	ASSERT(strlen(plan) < sizeof(load->plan));
+	strcpy(load->plan, plan);
+	load->error[0] = 0;
+	__atomic_store_n(&load->cancel, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&load->state, LLVL_LOAD_RUNNING, __ATOMIC_RELEASE);
+	AZ(pthread_create(&load->thread, NULL, load_thread_main, load));
 }
 
+int llvl_load_is_running(struct llvl_load* load)
+{
+	return __atomic_load_n(&load->state, __ATOMIC_ACQUIRE) != LLVL_LOAD_IDLE;
+}
+
+int llvl_load_poll(struct llvl_load* load, struct lvl* lvl, struct llvl_build_stats* stats)
+{
+	int state = __atomic_load_n(&load->state, __ATOMIC_ACQUIRE);
+	if (state == LLVL_LOAD_IDLE || state == LLVL_LOAD_RUNNING) return state;
+
+	AZ(pthread_join(load->thread, NULL));
+	__atomic_store_n(&load->state, LLVL_LOAD_IDLE, __ATOMIC_RELEASE);
+	if (state != LLVL_LOAD_DONE) return state;
+
+	*lvl = load->lvl;
+	if (stats) *stats = load->stats;
+	return state;
+}
+
+void llvl_load_cancel(struct llvl_load* load)
+{
+	if (__atomic_load_n(&load->state, __ATOMIC_ACQUIRE) == LLVL_LOAD_IDLE) return;
+
+	__atomic_store_n(&load->cancel, 1, __ATOMIC_RELEASE);
+	AZ(pthread_join(load->thread, NULL));
+	// it may have finished before noticing
+	if (__atomic_load_n(&load->state, __ATOMIC_ACQUIRE) == LLVL_LOAD_DONE) lvl_free(&load->lvl);
+	__atomic_store_n(&load->state, LLVL_LOAD_IDLE, __ATOMIC_RELEASE);
+}
@@ -1,8 +1,92 @@
 #ifndef LLVL_H
 
+#include <stdio.h>
+#include <pthread.h>
+
 #include "lvl.h"
+#include "lpool.h"
+
+#define LLVL_CACHE_DIR "cache"
+
+struct llvl_build_stats {
+	struct lpool_stats lua;
+	size_t lua_bytes_reserved; // small-block pool only
+	double build_ms;
+	int n_chunks_cached; // loaded from bytecode cache
+	int n_chunks_compiled; // parsed from source (cache miss)
+
+	// chunk render meshes before and after lua/locality.lua; misses of a
+	// simulated vertex cache, as exported, welded, and reordered
+	int n_triangles;
+	int vcache_misses_before, vcache_misses_welded, vcache_misses_after;
+	int n_vertices_before, n_vertices_after;
+};
+
+// stats may be NULL
+void llvl_build(const char* plan, struct lvl* lvl, struct llvl_build_stats* stats);
+
+/*
+asynchronous builds; llvl_load_start() runs llvl_build() on a loader thread
+and llvl_load_poll() hands the level over once it's done. that covers Lua,
+validation and derived lvl data; uploading it (render_set_lvl()) is left to
+the caller's GL thread. a build that fails (a Lua error, or a level that
+doesn't validate) ends the load with the error message rather than the
+process, so a bad reload can leave the current level in place.
+llvl_load_cancel() interrupts the build (Lua from a
+count hook, populate_lvl() between chunks and meshes, lvl_build_pvs() every
+few hundred portal steps) and waits for the loader thread to exit; that
+is a chunk's worth of work at most, not the rest of the build.
+
+a level build takes long enough that it gets its own thread rather than a
+job (see job.h); as a job it would tie up a worker, and could be picked up
+by the main thread while it helps out in job_wait().
+*/
+
+enum llvl_load_state {
+	LLVL_LOAD_IDLE = 0,
+	LLVL_LOAD_RUNNING,
+	LLVL_LOAD_DONE,
+	LLVL_LOAD_CANCELLED,
+	LLVL_LOAD_FAILED // see llvl_load.error
+};
+
+struct llvl_load {
+	char plan[256];
+	struct lvl lvl;
+	struct llvl_build_stats stats;
+	int state;
+	int cancel;
+	pthread_t thread;
+	char error[1024]; // valid after a failed load, until the next start
+};
+
+// load must be zeroed or idle
+void llvl_load_start(struct llvl_load* load, const char* plan);
+int llvl_load_is_running(struct llvl_load* load);
+// returns the load's state; a finished load (LLVL_LOAD_DONE, _CANCELLED or
+// _FAILED) is reported once, after which the load is idle. on
+// LLVL_LOAD_DONE the level is moved into lvl. stats may be NULL
+int llvl_load_poll(struct llvl_load* load, struct lvl* lvl, struct llvl_build_stats* stats);
+void llvl_load_cancel(struct llvl_load* load);
 
-void llvl_build(const char* plan, struct lvl* lvl);
+inline static void llvl_dump_build_stats(FILE* f, struct llvl_build_stats* stats)
+{
+	fprintf(f,
+		"llvl build: %.2fms, %d chunks cached, %d compiled, lua: %zd allocs, %zd frees, %zd reallocs, %zd large, %zd bytes peak, %zd bytes pooled\n",
+		stats->build_ms, stats->n_chunks_cached, stats->n_chunks_compiled,
+		stats->lua.n_allocs, stats->lua.n_frees, stats->lua.n_reallocs, stats->lua.n_large_allocs,
+		stats->lua.peak_bytes_in_use, stats->lua_bytes_reserved);
+	if (stats->n_triangles > 0) {
+		fprintf(f,
+			"llvl locality: %d triangles, ACMR %.3f exported, %.3f welded, %.3f reordered (%d/%d/%d misses), %d -> %d vertices\n",
+			stats->n_triangles,
+			(double)stats->vcache_misses_before / stats->n_triangles,
+			(double)stats->vcache_misses_welded / stats->n_triangles,
+			(double)stats->vcache_misses_after / stats->n_triangles,
+			stats->vcache_misses_before, stats->vcache_misses_welded, stats->vcache_misses_after,
+			stats->n_vertices_before, stats->n_vertices_after);
+	}
+}
 
 #define LLVL_H
 #endif
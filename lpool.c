@@ -0,0 +1,117 @@
+#include "lpool.h"
+
+struct lpool_large {
+	struct lpool_large* prev;
+	struct lpool_large* next;
+	size_t size;
+	size_t pad; // keep payload 16-byte aligned
+};
+
+void lpool_init(struct lpool* pool)
+{
+	memset(pool, 0, sizeof(*pool));
+	scratch_init(&pool->scratch, 1<<20);
+}
+
+void lpool_free(struct lpool* pool)
+{
+	struct lpool_large* large = pool->large;
+	while (large) {
+		struct lpool_large* next = large->next;
+		free(large);
+		large = next;
+	}
+	scratch_free(&pool->scratch);
+	memset(pool, 0, sizeof(*pool));
+}
+
+static int lpool_class(size_t sz)
+{
+	return (sz - 1) / LPOOL_GRANULARITY;
+}
+
+static void* lpool_get(struct lpool* pool, size_t sz)
+{
+	if (sz > LPOOL_MAX_SMALL) {
+		struct lpool_large* large = malloc(sizeof(*large) + sz);
+		if (large == NULL) return NULL;
+		large->prev = NULL;
+		large->next = pool->large;
+		large->size = sz;
+		if (pool->large) pool->large->prev = large;
+		pool->large = large;
+		pool->stats.n_large_allocs++;
+		return large + 1;
+	}
+
+	int c = lpool_class(sz);
+	void* p = pool->free_lists[c];
+	if (p) {
+		pool->free_lists[c] = *(void**)p;
+		return p;
+	}
+	return scratch_alloc_a16(&pool->scratch, (c + 1) * LPOOL_GRANULARITY);
+}
+
+static void lpool_put(struct lpool* pool, void* p, size_t sz)
+{
+	if (sz > LPOOL_MAX_SMALL) {
+		struct lpool_large* large = (struct lpool_large*)p - 1;
+		if (large->prev) {
+			large->prev->next = large->next;
+		} else {
+			pool->large = large->next;
+		}
+		if (large->next) large->next->prev = large->prev;
+		free(large);
+		return;
+	}
+
+	int c = lpool_class(sz);
+	*(void**)p = pool->free_lists[c];
+	pool->free_lists[c] = p;
+}
+
+void* lpool_lua_alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	struct lpool* pool = ud;
+
+	// when ptr is NULL, osize encodes the object type, not a size
+	if (ptr == NULL) osize = 0;
+
+	if (nsize == 0) {
+		if (ptr) {
+			lpool_put(pool, ptr, osize);
+			pool->stats.n_frees++;
+			pool->stats.bytes_in_use -= osize;
+		}
+		return NULL;
+	}
+
+	if (ptr == NULL) {
+		ptr = lpool_get(pool, nsize);
+		if (ptr == NULL) return NULL;
+		pool->stats.n_allocs++;
+		pool->stats.bytes_in_use += nsize;
+	} else {
+		pool->stats.n_reallocs++;
+
+		// same small class; nothing to do
+		int same_class = osize <= LPOOL_MAX_SMALL && nsize <= LPOOL_MAX_SMALL && lpool_class(osize) == lpool_class(nsize);
+		if (!same_class) {
+			void* p = lpool_get(pool, nsize);
+			if (p == NULL) return NULL;
+			memcpy(p, ptr, osize < nsize ? osize : nsize);
+			lpool_put(pool, ptr, osize);
+			ptr = p;
+		}
+		pool->stats.bytes_in_use += nsize;
+		pool->stats.bytes_in_use -= osize;
+	}
+
+	if (pool->stats.bytes_in_use > pool->stats.peak_bytes_in_use) {
+		pool->stats.peak_bytes_in_use = pool->stats.bytes_in_use;
+	}
+
+	return ptr;
+}
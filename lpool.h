@@ -0,0 +1,44 @@
+#ifndef LPOOL_H
+
+#include <stddef.h>
+
+#include "scratch.h"
+
+/*
+size-class pool allocator for Lua states (see lpool_lua_alloc()). small
+blocks are carved out of a scratch arena and recycled through per-class
+free lists; large blocks are malloc()'d and kept in a list. lpool_free()
+releases everything at once, so a throwaway Lua state leaves nothing
+behind in the process heap.
+*/
+
+#define LPOOL_GRANULARITY (16)
+#define LPOOL_MAX_SMALL (512)
+#define LPOOL_N_CLASSES (LPOOL_MAX_SMALL / LPOOL_GRANULARITY)
+
+struct lpool_stats {
+	size_t n_allocs;
+	size_t n_frees;
+	size_t n_reallocs;
+	size_t n_large_allocs;
+	size_t bytes_in_use;
+	size_t peak_bytes_in_use;
+};
+
+struct lpool_large;
+
+struct lpool {
+	struct scratch scratch;
+	void* free_lists[LPOOL_N_CLASSES];
+	struct lpool_large* large;
+	struct lpool_stats stats;
+};
+
+void lpool_init(struct lpool* pool);
+void lpool_free(struct lpool* pool);
+
+// lua_Alloc compatible; pass the pool as ud
+void* lpool_lua_alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+
+#define LPOOL_H
+#endif
@@ -2,27 +2,28 @@
 local lump_table = {}
 function lump_load(name)
 	if not lump_table[name] then
-		lump_table[name] = dofile("data/lumps/" .. name .. ".lump.lua")
+		-- loadfile_cached is provided by the host (llvl.c)
+		local load = loadfile_cached or loadfile
+		lump_table[name] = assert(load("data/lumps/" .. name .. ".lump.lua"))()
 	end
 	return lump_table[name]
 end
 
---[[
-function plan_load(name)
-	return require("plans/" .. name)()
+-- plan names are "<plan>" or "<plan>:<key>=<value>,...", e.g.
+-- "stress:seed=3,scale=10"; values that read as numbers become numbers.
+-- lua/plans/<plan>.lua returns a function taking the options and returning
+-- a lvl (see lvl.lua)
+function plan_load(plan_name)
+	local name, rest = plan_name:match("^([^:]+):?(.*)$")
+	local options = {}
+	for k, v in rest:gmatch("([%w_]+)=([^,]*)") do
+		options[k] = tonumber(v) or v
+	end
+	return require("plans/" .. name)(options)
 end
-]]
 
 return function (plan_name)
-	--local plan = plan_load(plan_name)
-	--print("hello, " .. plan)
-	--print(lump_load("stress"))
-
-	local lump = lump_load("t0")
-	local lvl = require('lvl')()
-
-	lvl:insert_lump(lump)
-
+	local lvl = plan_load(plan_name)
 	return require('compile')(lvl)
 end
 
@@ -0,0 +1,209 @@
+--[[
+builds a chunk's collision mesh from its render polygons:
+ - polygons with a non-solid material (see materials.lua) are dropped
+ - coplanar neighbours sharing an edge and a material are merged into larger
+   convex polygons, and collinear vertices removed
+ - hulls are added: lumps referenced by a dummy's "hull" property,
+   transformed by the dummy. author a simplified hull and give the detailed
+   faces a non-solid material to collide against the hull instead
+ - polygons with more than MAX_VERTICES vertices are split into fans
+
+polygons are lists of {x,y,z} with a material index (.mi); the result is
+encoded like chunk polygon lists, with vertices shared by position. polygons
+are in morton order (see locality.lua) and vertices in first-use order.
+]]
+
+local materials = require('materials')
+local locality = require('locality')
+
+local EPSILON = 1e-4
+local MAX_VERTICES = 32 -- LVL_MAX_COLLISION_POLYGON_VERTICES in lvl.h
+
+local function sub(a, b) return {a[1]-b[1], a[2]-b[2], a[3]-b[3]} end
+local function dot(a, b) return a[1]*b[1] + a[2]*b[2] + a[3]*b[3] end
+local function cross(a, b)
+	return {a[2]*b[3] - a[3]*b[2], a[3]*b[1] - a[1]*b[3], a[1]*b[2] - a[2]*b[1]}
+end
+
+local function key(v)
+	return string.format("%.4f,%.4f,%.4f", v[1], v[2], v[3])
+end
+
+local function polygon_normal(vs)
+	-- newell's method; robust against collinear leading vertices
+	local n = {0, 0, 0}
+	for i = 1, #vs do
+		local a, b = vs[i], vs[i % #vs + 1]
+		n[1] = n[1] + (a[2] - b[2]) * (a[3] + b[3])
+		n[2] = n[2] + (a[3] - b[3]) * (a[1] + b[1])
+		n[3] = n[3] + (a[1] - b[1]) * (a[2] + b[2])
+	end
+	local len = math.sqrt(dot(n, n))
+	if len < EPSILON then return nil end
+	return {n[1]/len, n[2]/len, n[3]/len}
+end
+
+-- drops vertices on the line between their neighbours
+local function remove_collinear(vs)
+	local out = {}
+	for i = 1, #vs do
+		local prev, cur, nxt = vs[(i - 2) % #vs + 1], vs[i], vs[i % #vs + 1]
+		local c = cross(sub(cur, prev), sub(nxt, cur))
+		if dot(c, c) > EPSILON*EPSILON then table.insert(out, cur) end
+	end
+	return out
+end
+
+local function is_convex(vs, n)
+	for i = 1, #vs do
+		local prev, cur, nxt = vs[(i - 2) % #vs + 1], vs[i], vs[i % #vs + 1]
+		if dot(cross(sub(cur, prev), sub(nxt, cur)), n) < -EPSILON then return false end
+	end
+	return true
+end
+
+-- joins p and q along p's edge i (p[i] -> p[i+1]) and q's reversed edge j
+local function splice(p, i, q, j)
+	local out = {}
+	for k = 0, #p - 1 do table.insert(out, p[(i + k) % #p + 1]) end
+	for k = 2, #q - 1 do table.insert(out, q[(j - 1 + k) % #q + 1]) end
+	return out
+end
+
+local function edge_key(a, b) return key(a) .. "|" .. key(b) end
+
+-- greedily merges polygons of one plane and material
+local function merge_coplanar(polys, n)
+	local edges = {} -- directed edge key => polygon
+	local function link(p, on)
+		for i = 1, #p do
+			edges[edge_key(p[i], p[i % #p + 1])] = on and p or nil
+		end
+	end
+	for _,p in ipairs(polys) do link(p, true) end
+
+	local alive, order = {}, {}
+	for _,p in ipairs(polys) do
+		alive[p] = true
+		table.insert(order, p)
+	end
+
+	local work = {}
+	for _,p in ipairs(polys) do table.insert(work, p) end
+	while #work > 0 do
+		local p = table.remove(work)
+		if alive[p] then
+			for i = 1, #p do
+				local a, b = p[i], p[i % #p + 1]
+				local q = edges[edge_key(b, a)]
+				if q and q ~= p and alive[q] then
+					local j
+					for k = 1, #q do
+						if key(q[k]) == key(b) and key(q[k % #q + 1]) == key(a) then j = k; break end
+					end
+					local merged = remove_collinear(splice(p, i, q, j))
+					if #merged >= 3 and #merged <= MAX_VERTICES and is_convex(merged, n) then
+						link(p, false); link(q, false)
+						alive[p] = nil; alive[q] = nil
+						merged.mi = p.mi
+						alive[merged] = true
+						table.insert(order, merged)
+						link(merged, true)
+						table.insert(work, merged)
+						break
+					end
+				end
+			end
+		end
+	end
+
+	local out = {}
+	for _,p in ipairs(order) do
+		if alive[p] then table.insert(out, p) end
+	end
+	return out
+end
+
+-- splits a convex polygon into pieces of at most MAX_VERTICES vertices,
+-- fanning out from its first vertex
+local function split(vs)
+	if #vs <= MAX_VERTICES then return {vs} end
+	local out = {}
+	local i = 2
+	while i < #vs do
+		local piece = {vs[1], mi = vs.mi}
+		for k = i, math.min(i + MAX_VERTICES - 2, #vs) do table.insert(piece, vs[k]) end
+		table.insert(out, piece)
+		i = i + MAX_VERTICES - 2
+	end
+	return out
+end
+
+local function transform(tx, v)
+	return {
+		tx[1]*v[1] + tx[2]*v[2] + tx[3]*v[3] + tx[4],
+		tx[5]*v[1] + tx[6]*v[2] + tx[7]*v[3] + tx[8],
+		tx[9]*v[1] + tx[10]*v[2] + tx[11]*v[3] + tx[12],
+	}
+end
+
+-- chunk: {polygons, dummies}; material_index(name) maps material names to
+-- indices
+return function (chunk, material_index)
+	local polygons = {}
+	local function add(p, tx)
+		if not materials.is_solid(p.mt) then return end
+		local vs = {mi = material_index(p.mt)}
+		for _,v in ipairs(p.vs) do
+			table.insert(vs, tx and transform(tx, v.co) or {v.co[1], v.co[2], v.co[3]})
+		end
+		for _,piece in ipairs(split(vs)) do table.insert(polygons, piece) end
+	end
+
+	for _,p in ipairs(chunk.polygons) do add(p) end
+	for _,dummy in ipairs(chunk.dummies or {}) do
+		if dummy.props.hull then
+			for _,p in ipairs(lump_load(dummy.props.hull).polygons) do add(p, dummy.tx) end
+		end
+	end
+
+	-- group by plane and material
+	local groups, group_order = {}, {}
+	for _,p in ipairs(polygons) do
+		local n = polygon_normal(p)
+		if n then
+			local d = dot(n, p[1])
+			local function q(x) return math.floor(x*1000 + 0.5) end
+			local k = string.format("%d:%d,%d,%d,%d", p.mi, q(n[1]), q(n[2]), q(n[3]), q(d))
+			if not groups[k] then
+				groups[k] = {n = n}
+				table.insert(group_order, k)
+			end
+			table.insert(groups[k], p)
+		end
+	end
+
+	local merged = {}
+	for _,k in ipairs(group_order) do
+		local group = groups[k]
+		for _,p in ipairs(merge_coplanar(group, group.n)) do table.insert(merged, p) end
+	end
+
+	local compiled = {vertices = {}, polygon_list = {}}
+	local vertex_map = {}
+	for _,pi in ipairs(locality.morton_order(merged)) do
+		local p = merged[pi]
+		table.insert(compiled.polygon_list, #p)
+		table.insert(compiled.polygon_list, p.mi)
+		for _,v in ipairs(p) do
+			local vk = key(v)
+			if not vertex_map[vk] then
+				table.insert(compiled.vertices, v)
+				vertex_map[vk] = #compiled.vertices - 1
+			end
+			table.insert(compiled.polygon_list, vertex_map[vk])
+		end
+	end
+	table.insert(compiled.polygon_list, 0)
+	return compiled
+end
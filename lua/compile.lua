@@ -1,25 +1,97 @@
+local locality = require('locality')
+
+local function material_index(name, clvl, matmap)
+	if not matmap[name] then
+		table.insert(clvl.materials, {name = name})
+		matmap[name] = #clvl.materials-1
+	end
+	return matmap[name]
+end
+
+local function compile_polygons(polygons, clvl, matmap)
+	local compiled = {vertices = {}, polygon_list = {}}
+	for _,p in ipairs(polygons) do
+		table.insert(compiled.polygon_list, #p.vs)
+		table.insert(compiled.polygon_list, material_index(p.mt, clvl, matmap))
+		for _,v in ipairs(p.vs) do
+			table.insert(compiled.vertices, v)
+			table.insert(compiled.polygon_list, #compiled.vertices - 1)
+		end
+	end
+	table.insert(compiled.polygon_list, 0)
+	return compiled
+end
+
 return function (lvl)
-	local clvl = {chunks = {}, portals = {}, materials = {}}
+	local clvl = {chunks = {}, portals = {}, materials = {}, meshes = {}}
 	local matmap = {}
+	local meshmap = {}
+
+	-- dummies with a "mesh" property become instances of that lump
+	local function mesh_index(name)
+		if not meshmap[name] then
+			local mesh = compile_polygons(lump_load(name).polygons, clvl, matmap)
+			mesh.name = name
+			table.insert(clvl.meshes, mesh)
+			meshmap[name] = #clvl.meshes-1
+		end
+		return meshmap[name]
+	end
+
 	for _,chunk in ipairs(lvl.chunks) do
-		local compiled_chunk = {vertices = {}, polygon_list = {}, portal_indices = {}}
-		for _,p in ipairs(chunk.polygons) do
-			if not matmap[p.mt] then
-				table.insert(clvl.materials, {name = p.mt})
-				matmap[p.mt] = #clvl.materials-1
-			end
+		local compiled_chunk = compile_polygons(chunk.polygons, clvl, matmap)
+		compiled_chunk.portal_indices = {}
+		compiled_chunk.collision = require('collision')(chunk, function (name)
+			return material_index(name, clvl, matmap)
+		end)
 
-			table.insert(compiled_chunk.polygon_list, #p.vs)
-			table.insert(compiled_chunk.polygon_list, matmap[p.mt])
-			for _,v in ipairs(p.vs) do
-				table.insert(compiled_chunk.vertices, v)
-				table.insert(compiled_chunk.polygon_list, #compiled_chunk.vertices - 1)
+		-- sorted by mesh so that each mesh is one instanced draw per chunk
+		compiled_chunk.instances = {}
+		for _,dummy in ipairs(chunk.dummies or {}) do
+			if dummy.props.mesh then
+				table.insert(compiled_chunk.instances, {mesh = mesh_index(dummy.props.mesh), tx = dummy.tx})
 			end
 		end
-		table.insert(compiled_chunk.polygon_list, 0)
+		table.sort(compiled_chunk.instances, function (a, b) return a.mesh < b.mesh end)
+
 		table.insert(clvl.chunks, compiled_chunk)
 	end
 
+	-- portal polygons are added to both chunks as loose vertices, which are
+	-- then paired up
+	for _,portal in ipairs(lvl.portals) do
+		local compiled_portal = {chunk_indices = {}, convex_vertex_pairs = {}, additional_vertex_pairs = {}}
+		local first = {}
+		for side,chunk_index in ipairs(portal.chunks) do
+			local compiled_chunk = clvl.chunks[chunk_index]
+			compiled_portal.chunk_indices[side] = chunk_index - 1
+			first[side] = #compiled_chunk.vertices
+			for _,co in ipairs(portal.vs) do
+				table.insert(compiled_chunk.vertices, {co = co, uv = {0, 0}})
+			end
+			table.insert(compiled_chunk.portal_indices, #clvl.portals)
+		end
+		for k = 1, #portal.vs do
+			table.insert(compiled_portal.convex_vertex_pairs, {first[1] + k - 1, first[2] + k - 1})
+		end
+		table.insert(clvl.portals, compiled_portal)
+	end
+
+	-- reorder chunk meshes for locality (see locality.lua). this renumbers
+	-- vertices, so it goes after the portal vertices have been paired up
+	clvl.locality = {n_triangles = 0, vcache_misses_before = 0, vcache_misses_welded = 0, vcache_misses_after = 0, n_vertices_before = 0, n_vertices_after = 0}
+	for chunk_index,compiled_chunk in ipairs(clvl.chunks) do
+		local remap, stats = locality.optimize(compiled_chunk)
+		for k,v in pairs(stats) do clvl.locality[k] = clvl.locality[k] + v end
+		for _,portal in ipairs(clvl.portals) do
+			for side,portal_chunk_index in ipairs(portal.chunk_indices) do
+				if portal_chunk_index == chunk_index - 1 then
+					for _,pair in ipairs(portal.convex_vertex_pairs) do pair[side] = remap[pair[side]] end
+					for _,pair in ipairs(portal.additional_vertex_pairs) do pair[side] = remap[pair[side]] end
+				end
+			end
+		end
+	end
+
 	return clvl
 end
-
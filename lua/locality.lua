@@ -0,0 +1,273 @@
+--[[
+reorders meshes for memory and vertex cache locality:
+ - morton_order() sorts polygons along a morton curve through their
+   centroids, so polygons that are close in space are close in memory
+ - optimize() takes a compiled chunk, welds vertices with equal position,
+   uv and polygon normal, walks its polygons with a vertex cache optimizer
+   seeded by morton order (after Forsyth, "Linear-Speed Vertex Cache
+   Optimisation"), and renumbers vertices in first-use order. vertices no
+   polygon uses (portal vertices) keep their order at the end; the
+   returned remap is for fixing up references to them
+
+render.c uploads each chunk's vertices once, with the normal of the
+polygons using them (hence welding by normal too), and draws the polygons
+in polygon list order as triangle fans indexing those vertices. vertex
+cache misses are counted with a FIFO of VCACHE_SIZE over the same fans.
+
+polygons end up in locality order, not grouped by material index; see
+polygon_list in lvl.h.
+]]
+
+local M = {}
+
+local VCACHE_SIZE = 16 -- FIFO; what misses are counted against
+local OPT_CACHE_SIZE = 32 -- LRU; what the optimizer scores against
+local MORTON_BITS = 10 -- per axis
+
+local function spread(x)
+	x = x & 0x3ff
+	x = (x | (x << 16)) & 0x30000ff
+	x = (x | (x << 8)) & 0x300f00f
+	x = (x | (x << 4)) & 0x30c30c3
+	x = (x | (x << 2)) & 0x9249249
+	return x
+end
+
+-- polygons: list of lists of positions ({x,y,z}); returns a permutation
+-- (list of polygon indices). ties keep their original order
+function M.morton_order(polygons)
+	local centroids = {}
+	local lo, hi = {math.huge, math.huge, math.huge}, {-math.huge, -math.huge, -math.huge}
+	for i,p in ipairs(polygons) do
+		local c = {0, 0, 0}
+		for _,v in ipairs(p) do
+			for k = 1, 3 do c[k] = c[k] + v[k] / #p end
+		end
+		for k = 1, 3 do
+			lo[k] = math.min(lo[k], c[k])
+			hi[k] = math.max(hi[k], c[k])
+		end
+		centroids[i] = c
+	end
+
+	local max = (1 << MORTON_BITS) - 1
+	local codes, order = {}, {}
+	for i,c in ipairs(centroids) do
+		local code = 0
+		for k = 1, 3 do
+			local extent = hi[k] - lo[k]
+			local q = extent > 0 and math.floor((c[k] - lo[k]) / extent * max + 0.5) or 0
+			code = code | (spread(q) << (k - 1))
+		end
+		codes[i] = code
+		order[i] = i
+	end
+	table.sort(order, function (a, b)
+		if codes[a] ~= codes[b] then return codes[a] < codes[b] end
+		return a < b
+	end)
+	return order
+end
+
+-- polygons: lists of vertex indices. returns misses and triangles
+function M.vcache_misses(polygons)
+	local fifo, in_cache, head = {}, {}, 1
+	local misses, triangles = 0, 0
+	local function use(v)
+		if in_cache[v] then return end
+		misses = misses + 1
+		if fifo[head] then in_cache[fifo[head]] = nil end
+		fifo[head] = v
+		in_cache[v] = true
+		head = head % VCACHE_SIZE + 1
+	end
+	for _,p in ipairs(polygons) do
+		for i = 2, #p - 1 do
+			use(p[1]); use(p[i]); use(p[i + 1])
+			triangles = triangles + 1
+		end
+	end
+	return misses, triangles
+end
+
+local function vertex_score(position, remaining)
+	if remaining == 0 then return -1 end
+	local score = 0
+	if position then
+		if position <= 3 then
+			score = 0.75
+		else
+			score = (1 - (position - 4) / (OPT_CACHE_SIZE - 3)) ^ 1.5
+		end
+	end
+	return score + 2 * remaining ^ -0.5
+end
+
+-- polygons: lists of vertex indices; seed: order to fall back on when no
+-- polygon touches the cache. returns a permutation
+local function vcache_order(polygons, seed)
+	local adjacent, remaining, score, position = {}, {}, {}, {}
+	for pi,p in ipairs(polygons) do
+		for _,v in ipairs(p) do
+			adjacent[v] = adjacent[v] or {}
+			table.insert(adjacent[v], pi)
+			remaining[v] = (remaining[v] or 0) + 1
+		end
+	end
+	for v in pairs(remaining) do score[v] = vertex_score(nil, remaining[v]) end
+
+	local function polygon_score(p)
+		local sum = 0
+		for _,v in ipairs(p) do sum = sum + score[v] end
+		return sum / #p
+	end
+
+	local emitted, order, cache = {}, {}, {}
+	local cursor = 1
+	local best
+	while #order < #polygons do
+		if not best then
+			while emitted[seed[cursor]] do cursor = cursor + 1 end
+			best = seed[cursor]
+		end
+
+		local p = polygons[best]
+		emitted[best] = true
+		table.insert(order, best)
+
+		-- p's vertices move to the front of the cache
+		local new_cache, in_p = {}, {}
+		for _,v in ipairs(p) do
+			if not in_p[v] then
+				in_p[v] = true
+				table.insert(new_cache, v)
+				remaining[v] = remaining[v] - 1
+			end
+		end
+		for _,v in ipairs(cache) do
+			if not in_p[v] then table.insert(new_cache, v) end
+		end
+		for i,v in ipairs(new_cache) do
+			position[v] = i <= OPT_CACHE_SIZE and i or nil
+			score[v] = vertex_score(position[v], remaining[v])
+			if i > OPT_CACHE_SIZE then new_cache[i] = nil end
+		end
+		cache = new_cache
+
+		best = nil
+		local best_score = -math.huge
+		for _,v in ipairs(cache) do
+			for _,pi in ipairs(adjacent[v]) do
+				if not emitted[pi] then
+					local s = polygon_score(polygons[pi])
+					if s > best_score or (s == best_score and pi < best) then
+						best, best_score = pi, s
+					end
+				end
+			end
+		end
+	end
+	return order
+end
+
+-- newell's method; nil for degenerate polygons
+local function polygon_normal(positions)
+	local n = {0, 0, 0}
+	for i = 1, #positions do
+		local a, b = positions[i], positions[i % #positions + 1]
+		n[1] = n[1] + (a[2] - b[2]) * (a[3] + b[3])
+		n[2] = n[2] + (a[3] - b[3]) * (a[1] + b[1])
+		n[3] = n[3] + (a[1] - b[1]) * (a[2] + b[2])
+	end
+	local len = math.sqrt(n[1]*n[1] + n[2]*n[2] + n[3]*n[3])
+	if len == 0 then return nil end
+	return {n[1]/len, n[2]/len, n[3]/len}
+end
+
+-- normals are compared at 1e-3, finer than the octahedral 16 bits render.c
+-- packs them to
+local function vertex_key(v, normal)
+	local nk = normal and string.format("%d,%d,%d", math.floor(normal[1]*1000 + 0.5), math.floor(normal[2]*1000 + 0.5), math.floor(normal[3]*1000 + 0.5)) or "-"
+	return string.format("%.17g,%.17g,%.17g,%.17g,%.17g|", v.co[1], v.co[2], v.co[3], v.uv[1], v.uv[2]) .. nk
+end
+
+-- compiled: {vertices, polygon_list} as built by compile.lua, vertices being
+-- {co, uv}. reorders it in place; returns a table of old to new vertex
+-- index (0-based, like the polygon list) and stats
+function M.optimize(compiled)
+	-- decode; indices are 1-based from here on
+	local polygons, materials = {}, {}
+	local i = 1
+	while compiled.polygon_list[i] ~= 0 do
+		local n = compiled.polygon_list[i]
+		local p = {}
+		for k = 1, n do p[k] = compiled.polygon_list[i + 1 + k] + 1 end
+		table.insert(polygons, p)
+		table.insert(materials, compiled.polygon_list[i + 1])
+		i = i + 2 + n
+	end
+
+	local stats = {n_vertices_before = #compiled.vertices}
+	stats.vcache_misses_before, stats.n_triangles = M.vcache_misses(polygons)
+
+	-- weld; exported vertices are per polygon corner, so each has one
+	-- polygon and one normal
+	local weld, canonical = {}, {}
+	for _,p in ipairs(polygons) do
+		local positions = {}
+		for k,v in ipairs(p) do positions[k] = compiled.vertices[v].co end
+		local normal = polygon_normal(positions)
+		for k,v in ipairs(p) do
+			local key = vertex_key(compiled.vertices[v], normal)
+			canonical[key] = canonical[key] or v
+			weld[v] = canonical[key]
+			p[k] = weld[v]
+		end
+	end
+	stats.vcache_misses_welded = M.vcache_misses(polygons)
+
+	local positions = {}
+	for pi,p in ipairs(polygons) do
+		positions[pi] = {}
+		for k,v in ipairs(p) do positions[pi][k] = compiled.vertices[v].co end
+	end
+	local order = vcache_order(polygons, M.morton_order(positions))
+
+	-- renumber in first-use order
+	local new_index, vertices = {}, {}
+	local function use(v)
+		if not new_index[v] then
+			table.insert(vertices, compiled.vertices[v])
+			new_index[v] = #vertices
+		end
+	end
+	local reordered, polygon_list = {}, {}
+	for _,pi in ipairs(order) do
+		local p = polygons[pi]
+		table.insert(polygon_list, #p)
+		table.insert(polygon_list, materials[pi])
+		local q = {}
+		for _,v in ipairs(p) do
+			use(v)
+			table.insert(polygon_list, new_index[v] - 1)
+			table.insert(q, new_index[v])
+		end
+		table.insert(reordered, q)
+	end
+	table.insert(polygon_list, 0)
+
+	local remap = {}
+	for v = 1, #compiled.vertices do
+		if not weld[v] then use(v) end
+		remap[v - 1] = new_index[weld[v] or v] - 1
+	end
+
+	compiled.vertices = vertices
+	compiled.polygon_list = polygon_list
+
+	stats.n_vertices_after = #vertices
+	stats.vcache_misses_after = M.vcache_misses(reordered)
+	return remap, stats
+end
+
+return M
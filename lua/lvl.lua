@@ -10,7 +10,14 @@ end
 
 mt.insert_lump = function (self, lump)
 	table.insert(self.chunks, lump)
-	return chunk
+	return #self.chunks
+end
+
+-- joins chunks a and b (indices as returned by insert_lump) through a convex
+-- polygon, given as a list of {x,y,z}
+mt.insert_portal = function (self, a, b, vs)
+	table.insert(self.portals, {chunks = {a, b}, vs = vs})
+	return #self.portals
 end
 
 return new
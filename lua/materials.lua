@@ -0,0 +1,15 @@
+--[[
+per-material properties, keyed by material name:
+ solid = false: left out of collision meshes (decals, foliage, detail faces
+   covered by a hull; see collision.lua)
+]]
+local properties = {
+	--["decal"] = {solid = false},
+}
+
+return {
+	is_solid = function (name)
+		local p = properties[name]
+		return not (p and p.solid == false)
+	end,
+}
@@ -0,0 +1,285 @@
+--[[
+procedural stress level for scaling tests; needs no blender and is
+deterministic for a given seed. rooms are laid out in a row along x, or in
+a grid in x/z, joined by doorway portals in the walls they share, and
+filled with staircases, slopes and n-gon prisms. room 1 is centred on the
+origin. doorways are spread evenly along a wall; the strip through the
+middle doorway(s) is kept clear (along x, and in grids also along z), the
+others may be partly blocked by detail.
+
+options (see plan_load() in build.lua), e.g. "stress:seed=3,scale=10":
+  seed      rng seed (1)
+  chunks    number of rooms (4)
+  layout    "row", or "grid" for ceil(sqrt(chunks)) columns, where rooms
+            have up to 4 neighbours (row)
+  polygons  detail polygons per room at scale 1 (200)
+  scale     multiplies polygons, for 1x/10x/100x runs (1)
+  ngon      max sides of prisms; 3-32 (6)
+  stairs    staircases per room (2)
+  slopes    slopes per room (2)
+  portals   doorways (portals) per shared wall; 0 leaves rooms sealed,
+            at most MAX_DOORS (1)
+]]
+
+local ROOM = 32 -- room width and depth
+local HEIGHT = 8
+local FLOOR = -1 -- entities spawn at the origin; their aabb reaches down 1
+local TILE = 4 -- floor tiles, like an exporter would split them
+local DOOR_WIDTH = 3
+local DOOR_HEIGHT = 3
+local CLEAR = 2 -- nothing is placed within this distance of a room's middle
+local MARGIN = 2 -- or of the walls
+local MAX_DOORS = math.floor((ROOM - 2 * MARGIN) / (DOOR_WIDTH + 1))
+
+local STEP_RISE = 0.25 -- below lvl_entity_max_step_up()
+local STEP_TREAD = 0.5
+local STAIR_WIDTH = 2
+
+local function rng(seed)
+	local state = (math.floor(seed) * 2654435761 + 1) & 0xffffffff
+	return function (lo, hi)
+		state = (state * 1664525 + 1013904223) & 0xffffffff
+		return lo + (hi - lo) * (state / 4294967296.0)
+	end
+end
+
+local function sub(a, b) return {a[1]-b[1], a[2]-b[2], a[3]-b[3]} end
+local function dot(a, b) return a[1]*b[1] + a[2]*b[2] + a[3]*b[3] end
+local function cross(a, b)
+	return {a[2]*b[3] - a[3]*b[2], a[3]*b[1] - a[1]*b[3], a[1]*b[2] - a[2]*b[1]}
+end
+
+-- adds polygon cos (convex, planar) facing `front`; winding is fixed up to
+-- match what export_lump.py produces
+local function face(polygons, cos, mt, front)
+	local n = cross(sub(cos[2], cos[3]), sub(cos[2], cos[1]))
+	if dot(n, front) < 0 then
+		local reversed = {}
+		for i = #cos, 1, -1 do table.insert(reversed, cos[i]) end
+		cos = reversed
+	end
+
+	-- planar uv projection along the dominant axis
+	local ax, ay, az = math.abs(front[1]), math.abs(front[2]), math.abs(front[3])
+	local vs = {}
+	for _,co in ipairs(cos) do
+		local uv
+		if ay >= ax and ay >= az then
+			uv = {co[1] * 0.5, co[3] * 0.5}
+		elseif ax >= az then
+			uv = {co[3] * 0.5, co[2] * 0.5}
+		else
+			uv = {co[1] * 0.5, co[2] * 0.5}
+		end
+		table.insert(vs, {co = co, uv = uv})
+	end
+	table.insert(polygons, {vs = vs, mt = mt})
+end
+
+-- local frame for structures: u runs along dir (0-3, quarter turns), w
+-- across it, y is up
+local function frame(ox, oz, dir)
+	local cu = ({{1,0}, {0,1}, {-1,0}, {0,-1}})[dir + 1]
+	local cw = {-cu[2], cu[1]}
+	local function at(u, y, w)
+		return {ox + cu[1]*u + cw[1]*w, y, oz + cu[2]*u + cw[2]*w}
+	end
+	local function direction(u, y, w)
+		return {cu[1]*u + cw[1]*w, y, cu[2]*u + cw[2]*w}
+	end
+	return at, direction
+end
+
+local function stairs(polygons, ox, oz, dir, n_steps)
+	local at, direction = frame(ox, oz, dir)
+	for s = 0, n_steps - 1 do
+		local u0, u1 = s * STEP_TREAD, (s + 1) * STEP_TREAD
+		local y0, y1 = FLOOR + s * STEP_RISE, FLOOR + (s + 1) * STEP_RISE
+		face(polygons, {at(u0, y1, 0), at(u1, y1, 0), at(u1, y1, STAIR_WIDTH), at(u0, y1, STAIR_WIDTH)}, "stair", direction(0, 1, 0))
+		face(polygons, {at(u0, y0, 0), at(u0, y1, 0), at(u0, y1, STAIR_WIDTH), at(u0, y0, STAIR_WIDTH)}, "stair", direction(-1, 0, 0))
+		face(polygons, {at(u0, FLOOR, 0), at(u1, FLOOR, 0), at(u1, y1, 0), at(u0, y1, 0)}, "stair", direction(0, 0, -1))
+		face(polygons, {at(u0, FLOOR, STAIR_WIDTH), at(u1, FLOOR, STAIR_WIDTH), at(u1, y1, STAIR_WIDTH), at(u0, y1, STAIR_WIDTH)}, "stair", direction(0, 0, 1))
+	end
+	local u, y = n_steps * STEP_TREAD, FLOOR + n_steps * STEP_RISE
+	face(polygons, {at(u, FLOOR, 0), at(u, y, 0), at(u, y, STAIR_WIDTH), at(u, FLOOR, STAIR_WIDTH)}, "stair", direction(1, 0, 0))
+end
+
+local function slope(polygons, ox, oz, dir, length, angle)
+	local at, direction = frame(ox, oz, dir)
+	local h = length * math.tan(angle)
+	local y1 = FLOOR + h
+	face(polygons, {at(0, FLOOR, 0), at(length, y1, 0), at(length, y1, STAIR_WIDTH), at(0, FLOOR, STAIR_WIDTH)}, "slope", direction(-h, length, 0))
+	face(polygons, {at(length, FLOOR, 0), at(length, y1, 0), at(length, y1, STAIR_WIDTH), at(length, FLOOR, STAIR_WIDTH)}, "slope", direction(1, 0, 0))
+	face(polygons, {at(0, FLOOR, 0), at(length, FLOOR, 0), at(length, y1, 0)}, "slope", direction(0, 0, -1))
+	face(polygons, {at(0, FLOOR, STAIR_WIDTH), at(length, FLOOR, STAIR_WIDTH), at(length, y1, STAIR_WIDTH)}, "slope", direction(0, 0, 1))
+end
+
+-- n-gon prism standing on the floor; n + 1 polygons
+local function prism(polygons, cx, cz, radius, height, n, rotation)
+	local y1 = FLOOR + height
+	local top = {}
+	for k = 0, n - 1 do
+		local a = rotation + 2 * math.pi * k / n
+		table.insert(top, {cx + math.cos(a) * radius, y1, cz + math.sin(a) * radius})
+	end
+	face(polygons, top, "detail", {0, 1, 0})
+	for k = 1, n do
+		local p, q = top[k], top[k % n + 1]
+		local mid = {(p[1] + q[1]) * 0.5 - cx, 0, (p[3] + q[3]) * 0.5 - cz}
+		face(polygons, {{p[1], FLOOR, p[3]}, {q[1], FLOOR, q[3]}, q, p}, "detail", mid)
+	end
+end
+
+-- centres of n doorways along a wall centred on c
+local function doors(c, n)
+	local spacing = (ROOM - 2 * MARGIN) / n
+	local centres = {}
+	for k = 1, n do table.insert(centres, c - (ROOM - 2 * MARGIN) * 0.5 + spacing * (k - 0.5)) end
+	return centres
+end
+
+-- point on a wall across axis (1: x, 3: z) at c; t runs along the wall
+local function wall_at(axis, c, t, y)
+	if axis == 1 then return {c, y, t} end
+	return {t, y, c}
+end
+
+-- wall across axis at c, from t0 to t1, with a doorway around each of
+-- door_centres
+local function wall(polygons, axis, c, t0, t1, door_centres, front)
+	local y0, y1 = FLOOR, FLOOR + HEIGHT
+	local function quad(ta, tb, ya, yb)
+		face(polygons, {wall_at(axis, c, ta, ya), wall_at(axis, c, tb, ya), wall_at(axis, c, tb, yb), wall_at(axis, c, ta, yb)}, "wall", front)
+	end
+	local d = DOOR_WIDTH * 0.5
+	local t = t0
+	for _,centre in ipairs(door_centres) do
+		quad(t, centre - d, y0, y1)
+		t = centre + d
+	end
+	quad(t, t1, y0, y1)
+	for _,centre in ipairs(door_centres) do quad(centre - d, centre + d, y0 + DOOR_HEIGHT, y1) end
+end
+
+-- rooms are numbered row by row; 0-based column and row of room index
+local function cell(index, columns)
+	return (index - 1) % columns, math.floor((index - 1) / columns)
+end
+
+-- neighbouring room indices in +x and +z, or nil
+local function neighbours(index, columns, n_rooms)
+	local column = cell(index, columns)
+	local east = (column + 1 < columns and index + 1 <= n_rooms) and index + 1 or nil
+	local south = (index + columns <= n_rooms) and index + columns or nil
+	return east, south
+end
+
+local function room(options, random, index, n_rooms, columns)
+	local polygons = {}
+	local column, row = cell(index, columns)
+	local xc, zc = column * ROOM, row * ROOM
+	local x0, x1 = xc - ROOM * 0.5, xc + ROOM * 0.5
+	local z0, z1 = zc - ROOM * 0.5, zc + ROOM * 0.5
+	local y1 = FLOOR + HEIGHT
+
+	-- doorways in each wall that's shared with a neighbour
+	local function wall_doors(neighbour, c)
+		if neighbour == nil or options.portals == 0 then return {} end
+		return doors(c, options.portals)
+	end
+	local east, south = neighbours(index, columns, n_rooms)
+	local west = column > 0 and index - 1 or nil
+	local north = row > 0 and index - columns or nil
+
+	for x = x0, x1 - TILE, TILE do
+		for z = z0, z1 - TILE, TILE do
+			face(polygons, {{x, FLOOR, z}, {x + TILE, FLOOR, z}, {x + TILE, FLOOR, z + TILE}, {x, FLOOR, z + TILE}}, "floor", {0, 1, 0})
+		end
+	end
+	face(polygons, {{x0, y1, z0}, {x1, y1, z0}, {x1, y1, z1}, {x0, y1, z1}}, "ceiling", {0, -1, 0})
+	wall(polygons, 3, z0, x0, x1, wall_doors(north, xc), {0, 0, 1})
+	wall(polygons, 3, z1, x0, x1, wall_doors(south, xc), {0, 0, -1})
+	wall(polygons, 1, x0, z0, z1, wall_doors(west, zc), {1, 0, 0})
+	wall(polygons, 1, x1, z0, z1, wall_doors(east, zc), {-1, 0, 0})
+
+	-- a random spot off the clear strip(s), with room for a footprint of
+	-- `size` in every direction
+	local function off_strip(size)
+		local t = random(CLEAR + size, ROOM * 0.5 - MARGIN - size)
+		if random(0, 1) < 0.5 then t = -t end
+		return t
+	end
+	local function spot(size)
+		local x
+		if options.layout == "grid" then
+			x = xc + off_strip(size)
+		else
+			x = random(x0 + MARGIN + size, x1 - MARGIN - size)
+		end
+		return x, zc + off_strip(size)
+	end
+
+	for _ = 1, options.stairs do
+		local n_steps = math.floor(random(4, 12))
+		local x, z = spot(n_steps * STEP_TREAD)
+		stairs(polygons, x, z, math.floor(random(0, 4)), n_steps)
+	end
+
+	for _ = 1, options.slopes do
+		local length = random(2, 5)
+		local x, z = spot(length)
+		slope(polygons, x, z, math.floor(random(0, 4)), length, math.rad(random(15, 40)))
+	end
+
+	local budget = options.polygons * options.scale
+	local n_details = 0
+	while n_details < budget do
+		local n = math.floor(random(3, options.ngon + 1))
+		local radius = random(0.2, 1.0)
+		local x, z = spot(radius)
+		prism(polygons, x, z, radius, random(0.1, 3), n, random(0, 2 * math.pi))
+		n_details = n_details + n + 1
+	end
+
+	return {polygons = polygons, dummies = {}}
+end
+
+return function (options)
+	local defaults = {seed = 1, chunks = 4, layout = "row", polygons = 200, scale = 1, ngon = 6, stairs = 2, slopes = 2, portals = 1}
+	for k,v in pairs(defaults) do
+		if options[k] == nil then options[k] = v end
+	end
+	assert(options.chunks >= 1, "chunks must be at least 1")
+	assert(options.layout == "row" or options.layout == "grid", "layout must be row or grid")
+	assert(options.ngon >= 3 and options.ngon <= 32, "ngon must be within 3-32")
+	assert(options.portals >= 0 and options.portals <= MAX_DOORS, "portals must be within 0-" .. MAX_DOORS)
+
+	local columns = options.chunks
+	if options.layout == "grid" then columns = math.ceil(math.sqrt(options.chunks)) end
+
+	local random = rng(options.seed)
+	local lvl = require('lvl')()
+	for i = 1, options.chunks do
+		lvl:insert_lump(room(options, random, i, options.chunks, columns))
+	end
+
+	local d = DOOR_WIDTH * 0.5
+	local y0, y1 = FLOOR, FLOOR + DOOR_HEIGHT
+	local function doorway(axis, c, centre)
+		return {wall_at(axis, c, centre - d, y0), wall_at(axis, c, centre + d, y0), wall_at(axis, c, centre + d, y1), wall_at(axis, c, centre - d, y1)}
+	end
+	for i = 1, options.chunks do
+		if options.portals == 0 then break end
+		local column, row = cell(i, columns)
+		local xc, zc = column * ROOM, row * ROOM
+		local east, south = neighbours(i, columns, options.chunks)
+		if east then
+			for _,centre in ipairs(doors(zc, options.portals)) do lvl:insert_portal(i, east, doorway(1, xc + ROOM * 0.5, centre)) end
+		end
+		if south then
+			for _,centre in ipairs(doors(xc, options.portals)) do lvl:insert_portal(i, south, doorway(3, zc + ROOM * 0.5, centre)) end
+		end
+	end
+
+	return lvl
+end
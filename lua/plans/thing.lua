@@ -1,3 +1,5 @@
 return function()
-	return "plan 9"
+	local lvl = require('lvl')()
+	lvl:insert_lump(lump_load("t0"))
+	return lvl
 end
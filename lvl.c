@@ -1,6 +1,11 @@
 #include <stdio.h>
 
 #include "lvl.h"
+#include "trace.h"
+#include "counters.h"
+#include "job.h"
+
+static uint32_t lvl_serial_counter;
 
 static void lvl_set_gravity(struct lvl* lvl, union vec3 v)
 {
@@ -8,7 +13,7 @@ static void lvl_set_gravity(struct lvl* lvl, union vec3 v)
 	lvl->gravity_normalized = vec3_normalize(lvl->gravity);
 }
 
-void lvl_init(struct lvl* lvl, int n_chunks, int n_portals, int n_materials)
+void lvl_init(struct lvl* lvl, int n_chunks, int n_portals, int n_materials, int n_meshes)
 {
 	memset(lvl, 0, sizeof(*lvl));
 
@@ -23,7 +28,13 @@ void lvl_init(struct lvl* lvl, int n_chunks, int n_portals, int n_materials)
 	lvl->n_materials = n_materials;
 	lvl->materials = scratch_alloc(&lvl->scratch, sizeof(*lvl->materials) * n_materials);
 
+	lvl->n_meshes = n_meshes;
+	lvl->meshes = scratch_alloc(&lvl->scratch, sizeof(*lvl->meshes) * n_meshes);
+
 	lvl_set_gravity(lvl, vec3_xyz(0, -10, 0));
+
+	// levels are built on the loader thread
+	lvl->serial = __sync_add_and_fetch(&lvl_serial_counter, 1);
 }
 
 void lvl_free(struct lvl* lvl)
@@ -37,7 +48,7 @@ struct lvl_chunk* lvl_get_chunk(struct lvl* lvl, uint32_t chunk_index)
 	return &lvl->chunks[chunk_index];
 }
 
-struct lvl_chunk* lvl_init_chunk(struct lvl* lvl, int chunk_index, int n_vertices, int polygon_list_size, int n_portal_indices)
+struct lvl_chunk* lvl_init_chunk(struct lvl* lvl, int chunk_index, int n_vertices, int polygon_list_size, int n_portal_indices, int n_instances)
 {
 	struct lvl_chunk* chunk = lvl_get_chunk(lvl, chunk_index);
 
@@ -49,9 +60,36 @@ struct lvl_chunk* lvl_init_chunk(struct lvl* lvl, int chunk_index, int n_vertice
 	chunk->n_portal_indices = n_portal_indices;
 	chunk->portal_indices = scratch_alloc(&lvl->scratch, sizeof(*chunk->portal_indices) * n_portal_indices);
 
+	chunk->n_instances = n_instances;
+	chunk->instances = scratch_alloc_a16(&lvl->scratch, sizeof(*chunk->instances) * n_instances);
+
 	return chunk;
 }
 
+struct lvl_chunk* lvl_init_chunk_collision(struct lvl* lvl, int chunk_index, int n_vertices, int polygon_list_size)
+{
+	struct lvl_chunk* chunk = lvl_get_chunk(lvl, chunk_index);
+
+	chunk->n_collision_vertices = n_vertices;
+	chunk->collision_vertices = scratch_alloc(&lvl->scratch, sizeof(*chunk->collision_vertices) * n_vertices);
+
+	chunk->collision_polygon_list = scratch_alloc(&lvl->scratch, sizeof(*chunk->collision_polygon_list) * polygon_list_size);
+
+	return chunk;
+}
+
+void lvl_chunk_collision_from_render(struct lvl* lvl, int chunk_index)
+{
+	struct lvl_chunk* chunk = lvl_get_chunk(lvl, chunk_index);
+
+	chunk->n_collision_vertices = chunk->n_vertices;
+	chunk->collision_vertices = scratch_alloc(&lvl->scratch, sizeof(*chunk->collision_vertices) * chunk->n_vertices);
+	for (int i = 0; i < chunk->n_vertices; i++) chunk->collision_vertices[i] = chunk->vertices[i].co;
+
+	// read only, so it can be shared
+	chunk->collision_polygon_list = chunk->polygon_list;
+}
+
 struct lvl_portal* lvl_get_portal(struct lvl* lvl, uint32_t portal_index)
 {
 	ASSERT(portal_index < lvl->n_portals);
@@ -84,12 +122,51 @@ int lvl_get_material_index(struct lvl* lvl, const char* name)
 	return -1;
 }
 
+struct lvl_mesh* lvl_get_mesh(struct lvl* lvl, uint32_t mesh_index)
+{
+	ASSERT(mesh_index < lvl->n_meshes);
+	return &lvl->meshes[mesh_index];
+}
+
+struct lvl_mesh* lvl_init_mesh(struct lvl* lvl, int mesh_index, int n_vertices, int polygon_list_size)
+{
+	struct lvl_mesh* mesh = lvl_get_mesh(lvl, mesh_index);
+
+	mesh->n_vertices = n_vertices;
+	mesh->vertices = scratch_alloc(&lvl->scratch, sizeof(*mesh->vertices) * n_vertices);
+
+	mesh->polygon_list = scratch_alloc(&lvl->scratch, sizeof(*mesh->polygon_list) * polygon_list_size);
+
+	return mesh;
+}
+
 int lvl_chunk_validate_polygon_list(struct lvl* lvl, struct lvl_chunk* chunk, int n_vertices, int polygon_list_size, char* errstr1024)
+{
+	return lvl_validate_polygon_list(lvl, chunk->polygon_list, n_vertices, polygon_list_size, errstr1024);
+}
+
+int lvl_chunk_validate_collision_polygon_list(struct lvl* lvl, struct lvl_chunk* chunk, int n_vertices, int polygon_list_size, char* errstr1024)
+{
+	int err = lvl_validate_polygon_list(lvl, chunk->collision_polygon_list, n_vertices, polygon_list_size, errstr1024);
+	if (err) return err;
+
+	for (int cursor = 0; chunk->collision_polygon_list[cursor] != 0; cursor += 2 + chunk->collision_polygon_list[cursor]) {
+		uint32_t n = chunk->collision_polygon_list[cursor];
+		if (n > LVL_MAX_COLLISION_POLYGON_VERTICES) {
+			snprintf(errstr1024, 1024, "collision polygon size %u exceeds max (%d) at index %d/%d", n, LVL_MAX_COLLISION_POLYGON_VERTICES, cursor, polygon_list_size);
+			return 1004;
+		}
+	}
+
+	return 0;
+}
+
+int lvl_validate_polygon_list(struct lvl* lvl, uint32_t* polygon_list, int n_vertices, int polygon_list_size, char* errstr1024)
 {
 	int state = 0;
 	uint32_t vertices_remaining = 0;
 	for (int i = 0; i < polygon_list_size; i++) {
-		uint32_t value = chunk->polygon_list[i];
+		uint32_t value = polygon_list[i];
 
 		if (state == 0) {
 			if (value == 0) {
@@ -133,6 +210,164 @@ int lvl_chunk_validate_polygon_list(struct lvl* lvl, struct lvl_chunk* chunk, in
 	return -1;
 }
 
+// vertices are `stride` bytes apart, each starting with its position
+static struct lvl_polygon* lvl_build_polygon_table(struct lvl* lvl, uint32_t* polygon_list, void* vertices, size_t stride, int* n_polygons)
+{
+	int n = 0;
+	for (int cursor = 0; polygon_list[cursor] != 0; cursor += 2 + polygon_list[cursor]) n++;
+	*n_polygons = n;
+
+	struct lvl_polygon* polygons = scratch_alloc(&lvl->scratch, sizeof(*polygons) * n);
+	int i = 0;
+	for (int cursor = 0; polygon_list[cursor] != 0; cursor += 2 + polygon_list[cursor]) {
+		struct lvl_polygon* p = &polygons[i++];
+		p->n_vertices = polygon_list[cursor];
+		p->material_index = polygon_list[cursor + 1];
+		p->offset = cursor + 2;
+
+		// polygons are planar, so the first triangle gives the plane
+		union vec3 v[3];
+		for (int j = 0; j < 3; j++) v[j] = *(union vec3*)((uint8_t*)vertices + polygon_list[p->offset + j] * stride);
+		p->normal = vec3_normalize(vec3_cross(vec3_sub(v[1], v[2]), vec3_sub(v[1], v[0])));
+		p->distance = vec3_dot(p->normal, v[0]);
+	}
+
+	return polygons;
+}
+
+struct lvl_bvh_item {
+	uint32_t polygon;
+	float min[3];
+	float max[3];
+	float centroid[3];
+};
+
+struct lvl_bvh_builder {
+	struct lvl_bvh_node* nodes;
+	int n_nodes;
+	struct lvl_bvh_item* items;
+};
+
+static int lvl_bvh_build_node(struct lvl_bvh_builder* b, int first, int count, int depth)
+{
+	int node_index = b->n_nodes++;
+	struct lvl_bvh_node* node = &b->nodes[node_index];
+
+	float cmin[3], cmax[3];
+	for (int i = 0; i < count; i++) {
+		struct lvl_bvh_item* item = &b->items[first + i];
+		for (int k = 0; k < 3; k++) {
+			if (i == 0 || item->min[k] < node->min[k]) node->min[k] = item->min[k];
+			if (i == 0 || item->max[k] > node->max[k]) node->max[k] = item->max[k];
+			if (i == 0 || item->centroid[k] < cmin[k]) cmin[k] = item->centroid[k];
+			if (i == 0 || item->centroid[k] > cmax[k]) cmax[k] = item->centroid[k];
+		}
+	}
+
+	if (count <= LVL_BVH_LEAF_SIZE || depth >= (LVL_BVH_MAX_DEPTH - 1)) {
+		node->offset = first;
+		node->count = count;
+		return node_index;
+	}
+
+	// split at the middle of the longest centroid axis; fall back to
+	// splitting the list in half if every centroid lands on one side
+	int axis = 0;
+	for (int k = 1; k < 3; k++) if ((cmax[k] - cmin[k]) > (cmax[axis] - cmin[axis])) axis = k;
+	float mid = (cmin[axis] + cmax[axis]) * 0.5f;
+	int n_left = 0;
+	for (int i = 0; i < count; i++) {
+		if (b->items[first + i].centroid[axis] < mid) {
+			struct lvl_bvh_item tmp = b->items[first + i];
+			b->items[first + i] = b->items[first + n_left];
+			b->items[first + n_left] = tmp;
+			n_left++;
+		}
+	}
+	if (n_left == 0 || n_left == count) n_left = count / 2;
+
+	node->count = 0;
+	lvl_bvh_build_node(b, first, n_left, depth + 1);
+	int right = lvl_bvh_build_node(b, first + n_left, count - n_left, depth + 1);
+	b->nodes[node_index].offset = right;
+	return node_index;
+}
+
+static void lvl_chunk_build_bvh(struct lvl* lvl, struct lvl_chunk* chunk)
+{
+	int n_polygons = chunk->n_collision_polygons;
+
+	chunk->n_bvh_nodes = 0;
+	chunk->bvh_nodes = NULL;
+	chunk->bvh_polygons = NULL;
+	if (n_polygons == 0) return;
+
+	struct lvl_bvh_builder b;
+	b.n_nodes = 0;
+	b.nodes = scratch_alloc_a16(&lvl->scratch, sizeof(*b.nodes) * (2 * n_polygons - 1));
+	AN(b.items = malloc(sizeof(*b.items) * n_polygons));
+
+	for (int i = 0; i < n_polygons; i++) {
+		struct lvl_bvh_item* item = &b.items[i];
+		struct lvl_polygon* p = &chunk->collision_polygons[i];
+		item->polygon = i;
+		for (int j = 0; j < p->n_vertices; j++) {
+			union vec3 co = chunk->collision_vertices[chunk->collision_polygon_list[p->offset + j]];
+			for (int k = 0; k < 3; k++) {
+				if (j == 0 || co.s[k] < item->min[k]) item->min[k] = co.s[k];
+				if (j == 0 || co.s[k] > item->max[k]) item->max[k] = co.s[k];
+			}
+		}
+		for (int k = 0; k < 3; k++) item->centroid[k] = (item->min[k] + item->max[k]) * 0.5f;
+	}
+
+	lvl_bvh_build_node(&b, 0, n_polygons, 0);
+
+	chunk->n_bvh_nodes = b.n_nodes;
+	chunk->bvh_nodes = b.nodes;
+	chunk->bvh_polygons = scratch_alloc(&lvl->scratch, sizeof(*chunk->bvh_polygons) * n_polygons);
+	for (int j = 0; j < n_polygons; j++) chunk->bvh_polygons[j] = b.items[j].polygon;
+
+	free(b.items);
+}
+
+void lvl_chunk_finalize(struct lvl* lvl, struct lvl_chunk* chunk)
+{
+	// bounding box
+	union vec3 min = {{0,0,0}};
+	union vec3 max = {{0,0,0}};
+	for (int i = 0; i < chunk->n_vertices; i++) {
+		union vec3 co = chunk->vertices[i].co;
+		for (int j = 0; j < 3; j++) {
+			if (i == 0 || co.s[j] < min.s[j]) min.s[j] = co.s[j];
+			if (i == 0 || co.s[j] > max.s[j]) max.s[j] = co.s[j];
+		}
+	}
+	chunk->aabb.center = vec3_scale(vec3_add(min, max), 0.5f);
+	chunk->aabb.extent = vec3_scale(vec3_sub(max, min), 0.5f);
+
+	chunk->polygons = lvl_build_polygon_table(lvl, chunk->polygon_list, chunk->vertices, sizeof(*chunk->vertices), &chunk->n_polygons);
+	if (chunk->collision_polygon_list == chunk->polygon_list) {
+		// see lvl_chunk_collision_from_render()
+		chunk->n_collision_polygons = chunk->n_polygons;
+		chunk->collision_polygons = chunk->polygons;
+	} else {
+		chunk->collision_polygons = lvl_build_polygon_table(lvl, chunk->collision_polygon_list, chunk->collision_vertices, sizeof(*chunk->collision_vertices), &chunk->n_collision_polygons);
+	}
+
+	lvl_chunk_build_bvh(lvl, chunk);
+}
+
+void lvl_mesh_finalize(struct lvl* lvl, struct lvl_mesh* mesh)
+{
+	mesh->polygons = lvl_build_polygon_table(lvl, mesh->polygon_list, mesh->vertices, sizeof(*mesh->vertices), &mesh->n_polygons);
+}
+
+void lvl_chunk_changed(struct lvl* lvl, uint32_t chunk_index)
+{
+	lvl_get_chunk(lvl, chunk_index)->revision++;
+}
+
 int lvl_validate_misc(struct lvl* lvl, char* errstr1024)
 {
 	// check that portal indices are within bounds
@@ -147,6 +382,22 @@ int lvl_validate_misc(struct lvl* lvl, char* errstr1024)
 		}
 	}
 
+	// check that instance mesh indices are within bounds
+	for (int i = 0; i < lvl->n_chunks; i++) {
+		struct lvl_chunk* chunk = lvl_get_chunk(lvl, i);
+		for (int j = 0; j < chunk->n_instances; j++) {
+			uint32_t v = chunk->instances[j].mesh_index;
+			if (v >= lvl->n_meshes) {
+				snprintf(errstr1024, 1024, "mesh index %u/%d out of bounds at instances[%d] in chunk %d", v, lvl->n_meshes, j, i);
+				return 3001;
+			}
+			if (j > 0 && v < chunk->instances[j-1].mesh_index) {
+				snprintf(errstr1024, 1024, "instances not sorted by mesh index at instances[%d] in chunk %d", j, i);
+				return 3002;
+			}
+		}
+	}
+
 	// check portal
 	for (int i = 0; i < lvl->n_portals; i++) {
 		struct lvl_portal* portal = lvl_get_portal(lvl, i);
@@ -162,6 +413,11 @@ int lvl_validate_misc(struct lvl* lvl, char* errstr1024)
 			chunks[j] = lvl_get_chunk(lvl, chunk_index);
 		}
 
+		if (portal->n_convex_vertex_pairs > LVL_MAX_COLLISION_POLYGON_VERTICES) {
+			snprintf(errstr1024, 1024, "%d convex vertex pairs in portal %d exceeds max (%d)", portal->n_convex_vertex_pairs, i, LVL_MAX_COLLISION_POLYGON_VERTICES);
+			return 2003;
+		}
+
 		// check that vertex indices are within bounds
 		int n = (portal->n_convex_vertex_pairs + portal->n_additional_vertex_pairs) * 2;
 		for (int j = 0; j < n; j++) {
@@ -199,16 +455,24 @@ void lvl_entity_move(struct lvl_entity* e, float forward, float right, float jum
 	e->move_forward = forward;
 	e->move_right = right;
 	e->move_jump = jump;
+	if (forward != 0 || right != 0 || jump != 0) lvl_entity_wake(e);
 }
 
 void lvl_entity_accelerate(struct lvl_entity* e, union vec3 a, float dt)
 {
 	e->velocity = vec3_add(e->velocity, vec3_scale(a, dt));
+	lvl_entity_wake(e);
 }
 
 void lvl_entity_impulse(struct lvl_entity* e, union vec3 imp)
 {
 	e->velocity = vec3_add(e->velocity, imp);
+	lvl_entity_wake(e);
+}
+
+void lvl_entity_wake(struct lvl_entity* e)
+{
+	e->sleeping = 0;
 }
 
 static struct aabb lvl_entity_aabb(struct lvl_entity* e)
@@ -230,14 +494,594 @@ static float lvl_entity_max_step_up(struct lvl_entity* e)
 	return 0.4f;
 }
 
+// ray vs convex planar polygon, from either side. returns 1 and sets *t and
+// *normal (unnormalized, facing the ray origin) if hit within [tmin;tmax)
+static int lvl_ray_polygon(union vec3 origin, union vec3 direction, float tmin, float tmax, union vec3* polygon, int polygon_n, float* t, union vec3* normal)
+{
+	union vec3 n = vec3_cross(vec3_sub(polygon[1], polygon[0]), vec3_sub(polygon[2], polygon[0]));
+	float denom = vec3_dot(n, direction);
+	if (fabsf(denom) < 1e-12f) return 0; // parallel
+
+	float tp = vec3_dot(n, vec3_sub(polygon[0], origin)) / denom;
+	if (tp < tmin || tp >= tmax) return 0;
+
+	union vec3 p = vec3_add(origin, vec3_scale(direction, tp));
+	int prev = polygon_n - 1;
+	for (int i = 0; i < polygon_n; i++) {
+		union vec3 edge = vec3_sub(polygon[i], polygon[prev]);
+		if (vec3_dot(vec3_cross(edge, vec3_sub(p, polygon[prev])), n) < 0) return 0;
+		prev = i;
+	}
+
+	*t = tp;
+	*normal = denom > 0 ? vec3_scale(n, -1) : n;
+	return 1;
+}
+
+static int lvl_ray_aabb(struct lvl_bvh_node* node, union vec3 origin, union vec3 inv_direction, float tmin, float tmax, float* tnear)
+{
+	for (int k = 0; k < 3; k++) {
+		float a = (node->min[k] - origin.s[k]) * inv_direction.s[k];
+		float b = (node->max[k] - origin.s[k]) * inv_direction.s[k];
+		// fminf/fmaxf drop the NaN from 0*inf on a slab boundary
+		tmin = fmaxf(tmin, fminf(a, b));
+		tmax = fminf(tmax, fmaxf(a, b));
+		if (tmin > tmax) return 0;
+	}
+	*tnear = tmin;
+	return 1;
+}
+
+// nearest polygon hit in a single chunk; updates hit and returns 1 if one is
+// found before tmax
+static int lvl_chunk_raycast(struct lvl_chunk* chunk, union vec3 origin, union vec3 direction, float tmin, float tmax, struct lvl_ray_hit* hit)
+{
+	if (chunk->n_bvh_nodes == 0) return 0;
+
+	union vec3 inv_direction;
+	for (int k = 0; k < 3; k++) inv_direction.s[k] = 1.0f / direction.s[k];
+
+	int found = 0;
+	uint32_t stack[LVL_BVH_MAX_DEPTH + 1];
+	int sp = 0;
+	stack[sp++] = 0;
+	while (sp > 0) {
+		struct lvl_bvh_node* node = &chunk->bvh_nodes[stack[--sp]];
+		float tnear;
+		if (!lvl_ray_aabb(node, origin, inv_direction, tmin, tmax, &tnear)) continue;
+
+		if (node->count == 0) {
+			// visit the nearer child first so that tmax shrinks early
+			uint32_t left = (node - chunk->bvh_nodes) + 1;
+			uint32_t right = node->offset;
+			float tl = 0, tr = 0;
+			int hl = lvl_ray_aabb(&chunk->bvh_nodes[left], origin, inv_direction, tmin, tmax, &tl);
+			int hr = lvl_ray_aabb(&chunk->bvh_nodes[right], origin, inv_direction, tmin, tmax, &tr);
+			if (hl && hr) {
+				if (tl <= tr) {
+					stack[sp++] = right;
+					stack[sp++] = left;
+				} else {
+					stack[sp++] = left;
+					stack[sp++] = right;
+				}
+			} else if (hl) {
+				stack[sp++] = left;
+			} else if (hr) {
+				stack[sp++] = right;
+			}
+			continue;
+		}
+
+		for (int i = 0; i < node->count; i++) {
+			uint32_t polygon_index = chunk->bvh_polygons[node->offset + i];
+			struct lvl_polygon* p = &chunk->collision_polygons[polygon_index];
+			union vec3 polygon[LVL_MAX_COLLISION_POLYGON_VERTICES];
+			ASSERT(p->n_vertices <= LVL_MAX_COLLISION_POLYGON_VERTICES);
+			for (int j = 0; j < p->n_vertices; j++) polygon[j] = chunk->collision_vertices[chunk->collision_polygon_list[p->offset + j]];
+
+			float t;
+			union vec3 normal;
+			if (lvl_ray_polygon(origin, direction, tmin, tmax, polygon, p->n_vertices, &t, &normal)) {
+				tmax = t;
+				hit->polygon = polygon_index;
+				hit->material_index = p->material_index;
+				hit->distance = t;
+				hit->normal = normal;
+				found = 1;
+			}
+		}
+	}
+
+	return found;
+}
+
+int lvl_raycast(struct lvl* lvl, uint32_t chunk_index, union vec3 origin, union vec3 direction, float max_distance, struct lvl_ray_hit* hit)
+{
+	float length = vec3_length(direction);
+	if (length == 0.0f) return 0;
+	direction = vec3_scale(direction, 1.0f / length);
+
+	float tmin = 0;
+	int32_t entered_through = -1;
+	for (int hop = 0; hop < LVL_RAYCAST_MAX_CHUNKS; hop++) {
+		struct lvl_chunk* chunk = lvl_get_chunk(lvl, chunk_index);
+
+		struct lvl_ray_hit chunk_hit;
+		float tmax = max_distance;
+		int found = lvl_chunk_raycast(chunk, origin, direction, tmin, tmax, &chunk_hit);
+		if (found) tmax = chunk_hit.distance;
+
+		// leave through the nearest portal in front of the nearest hit
+		int32_t exit_portal = -1;
+		uint32_t exit_chunk_index = 0;
+		float exit_t = tmax;
+		for (int i = 0; i < chunk->n_portal_indices; i++) {
+			uint32_t portal_index = chunk->portal_indices[i];
+			if ((int32_t)portal_index == entered_through) continue;
+			struct lvl_portal* portal = lvl_get_portal(lvl, portal_index);
+			int side = portal->chunk_indices[0] == chunk_index ? 0 : 1;
+			int n = portal->n_convex_vertex_pairs;
+			if (n < 3) continue;
+			union vec3 polygon[LVL_MAX_COLLISION_POLYGON_VERTICES];
+			ASSERT(n <= LVL_MAX_COLLISION_POLYGON_VERTICES);
+			for (int j = 0; j < n; j++) polygon[j] = chunk->vertices[portal->vertex_pairs[j*2 + side]].co;
+			float t;
+			union vec3 normal;
+			if (lvl_ray_polygon(origin, direction, tmin, exit_t, polygon, n, &t, &normal)) {
+				exit_t = t;
+				exit_portal = portal_index;
+				exit_chunk_index = portal->chunk_indices[1 - side];
+			}
+		}
+
+		if (exit_portal >= 0) {
+			chunk_index = exit_chunk_index;
+			entered_through = exit_portal;
+			tmin = exit_t;
+			continue;
+		}
+
+		if (!found) return 0;
+		*hit = chunk_hit;
+		hit->chunk_index = chunk_index;
+		hit->point = vec3_add(origin, vec3_scale(direction, hit->distance));
+		hit->normal = vec3_normalize(hit->normal);
+		return 1;
+	}
+
+	return 0;
+}
+
+int lvl_segment_cast(struct lvl* lvl, uint32_t chunk_index, union vec3 from, union vec3 to, struct lvl_ray_hit* hit)
+{
+	union vec3 d = vec3_sub(to, from);
+	return lvl_raycast(lvl, chunk_index, from, d, vec3_length(d), hit);
+}
+
+struct lvl_raycast_batch {
+	struct lvl* lvl;
+	struct lvl_ray* rays;
+	struct lvl_ray_hit* hits;
+	int* results;
+};
+
+static void lvl_raycast_batch_range(void* usr, int begin, int end)
+{
+	struct lvl_raycast_batch* b = usr;
+	for (int i = begin; i < end; i++) {
+		struct lvl_ray* ray = &b->rays[i];
+		b->results[i] = lvl_raycast(b->lvl, ray->chunk_index, ray->origin, ray->direction, ray->max_distance, &b->hits[i]);
+	}
+}
+
+void lvl_raycast_batch(struct lvl* lvl, int n, struct lvl_ray* rays, struct lvl_ray_hit* hits, int* results)
+{
+	struct lvl_raycast_batch b;
+	b.lvl = lvl;
+	b.rays = rays;
+	b.hits = hits;
+	b.results = results;
+	job_parallel_for(n, 64, lvl_raycast_batch_range, &b);
+}
+
+int lvl_can_see(struct lvl* lvl, uint32_t from_chunk_index, union vec3 from, uint32_t to_chunk_index, union vec3 to)
+{
+	if (!lvl_chunk_maybe_visible(lvl, from_chunk_index, to_chunk_index)) return 0;
+	struct lvl_ray_hit hit;
+	return !lvl_segment_cast(lvl, from_chunk_index, from, to, &hit);
+}
+
+struct lvl_pvs_plane {
+	union vec3 normal;
+	float distance;
+};
+
+struct lvl_pvs_winding {
+	int n;
+	union vec3 v[LVL_PVS_MAX_WINDING];
+};
+
+struct lvl_pvs_portal {
+	int oriented; // chunk 0 entirely behind plane, chunk 1 entirely in front
+	struct lvl_pvs_plane plane; // facing chunk 1
+	struct lvl_pvs_winding winding;
+};
+
+struct lvl_pvs_build {
+	struct lvl* lvl;
+	struct lvl_pvs_portal* portals;
+	int* cancel; // may be NULL
+};
+
+// state for one source chunk
+struct lvl_pvs_flow {
+	struct lvl* lvl;
+	struct lvl_pvs_portal* portals;
+	uint32_t* row;
+	uint8_t* on_stack; // per portal
+	uint8_t* flooded; // per chunk
+	int steps;
+	int* cancel; // may be NULL
+	int cancelled;
+};
+
+#define LVL_PVS_CANCEL_CHECK_STEPS (256)
+
+static int lvl_pvs_is_cancelled(int* cancel)
+{
+	return cancel != NULL && __atomic_load_n(cancel, __ATOMIC_ACQUIRE);
+}
+
+static float lvl_pvs_plane_distance(const struct lvl_pvs_plane* plane, union vec3 p)
+{
+	return vec3_dot(plane->normal, p) - plane->distance;
+}
+
+static struct lvl_pvs_plane lvl_pvs_plane_flip(struct lvl_pvs_plane plane)
+{
+	plane.normal = vec3_scale(plane.normal, -1);
+	plane.distance = -plane.distance;
+	return plane;
+}
+
+// keeps the part of w in front of plane (and within LVL_PVS_EPSILON behind
+// it, erring on the side of visibility)
+static void lvl_pvs_clip(struct lvl_pvs_winding* w, const struct lvl_pvs_plane* plane)
+{
+	float d[LVL_PVS_MAX_WINDING];
+	int n_behind = 0;
+	for (int i = 0; i < w->n; i++) {
+		d[i] = lvl_pvs_plane_distance(plane, w->v[i]);
+		if (d[i] < -LVL_PVS_EPSILON) n_behind++;
+	}
+	if (n_behind == 0) return;
+	if (n_behind == w->n) {
+		w->n = 0;
+		return;
+	}
+	// a clip adds at most one vertex; if there's no room, not clipping is
+	// conservative
+	if (w->n == LVL_PVS_MAX_WINDING) return;
+
+	struct lvl_pvs_winding out;
+	out.n = 0;
+	for (int i = 0; i < w->n; i++) {
+		int j = (i+1) % w->n;
+		int in_i = d[i] >= -LVL_PVS_EPSILON;
+		int in_j = d[j] >= -LVL_PVS_EPSILON;
+		if (in_i) out.v[out.n++] = w->v[i];
+		if (in_i != in_j) {
+			float t = d[i] / (d[i] - d[j]);
+			out.v[out.n++] = vec3_add(w->v[i], vec3_scale(vec3_sub(w->v[j], w->v[i]), t));
+		}
+	}
+	*w = out;
+}
+
+/*
+clips target by the planes through an edge of a and a vertex of b that
+have a and b on opposite sides, keeping the pass side. any line through
+source and then pass stays on the pass side of those planes. called with
+a=source, b=pass and then with a=pass, b=source
+*/
+static void lvl_pvs_clip_to_separators(const struct lvl_pvs_winding* a, const struct lvl_pvs_winding* b, int b_is_pass, struct lvl_pvs_winding* target)
+{
+	for (int i = 0; i < a->n && target->n >= 3; i++) {
+		union vec3 v0 = a->v[i];
+		union vec3 v1 = a->v[(i+1) % a->n];
+		for (int j = 0; j < b->n && target->n >= 3; j++) {
+			union vec3 normal = vec3_cross(vec3_sub(v1, v0), vec3_sub(b->v[j], v0));
+			float length = vec3_length(normal);
+			if (length < LVL_PVS_EPSILON) continue;
+			struct lvl_pvs_plane plane;
+			plane.normal = vec3_scale(normal, 1.0f / length);
+			plane.distance = vec3_dot(plane.normal, v0);
+
+			// b must be in front (v[j] is on the plane), a behind
+			int separates = 1;
+			for (int k = 0; k < b->n && separates; k++) {
+				if (lvl_pvs_plane_distance(&plane, b->v[k]) < -LVL_PVS_EPSILON) separates = 0;
+			}
+			int a_behind = 0;
+			for (int k = 0; k < a->n && separates; k++) {
+				float d = lvl_pvs_plane_distance(&plane, a->v[k]);
+				if (d > LVL_PVS_EPSILON) separates = 0;
+				if (d < -LVL_PVS_EPSILON) a_behind = 1;
+			}
+			if (!separates || !a_behind) continue;
+
+			if (!b_is_pass) plane = lvl_pvs_plane_flip(plane);
+			lvl_pvs_clip(target, &plane);
+		}
+	}
+}
+
+static void lvl_pvs_mark(struct lvl_pvs_flow* f, uint32_t chunk_index)
+{
+	f->row[chunk_index >> 5] |= 1u << (chunk_index & 31);
+}
+
+// marks everything reachable through portals from chunk_index
+static void lvl_pvs_flood(struct lvl_pvs_flow* f, uint32_t chunk_index)
+{
+	if (f->flooded[chunk_index]) return;
+	f->flooded[chunk_index] = 1;
+	lvl_pvs_mark(f, chunk_index);
+	struct lvl_chunk* chunk = lvl_get_chunk(f->lvl, chunk_index);
+	for (int i = 0; i < chunk->n_portal_indices; i++) {
+		struct lvl_portal* portal = lvl_get_portal(f->lvl, chunk->portal_indices[i]);
+		int side = portal->chunk_indices[0] == chunk_index ? 0 : 1;
+		lvl_pvs_flood(f, portal->chunk_indices[1 - side]);
+	}
+}
+
+// follows sight lines that entered chunk_index through source and then
+// pass (both NULL in the source chunk, pass NULL in its neighbours)
+static void lvl_pvs_recurse(
+	struct lvl_pvs_flow* f,
+	uint32_t chunk_index,
+	int depth,
+	const struct lvl_pvs_winding* source,
+	const struct lvl_pvs_plane* source_plane,
+	const struct lvl_pvs_winding* pass,
+	const struct lvl_pvs_plane* pass_plane)
+{
+	struct lvl_chunk* chunk = lvl_get_chunk(f->lvl, chunk_index);
+	for (int i = 0; i < chunk->n_portal_indices; i++) {
+		uint32_t portal_index = chunk->portal_indices[i];
+		if (f->on_stack[portal_index]) continue;
+		struct lvl_portal* portal = lvl_get_portal(f->lvl, portal_index);
+		struct lvl_pvs_portal* pp = &f->portals[portal_index];
+		int side = portal->chunk_indices[0] == chunk_index ? 0 : 1;
+		uint32_t next_chunk_index = portal->chunk_indices[1 - side];
+
+		f->steps++;
+		if ((f->steps % LVL_PVS_CANCEL_CHECK_STEPS) == 0 && lvl_pvs_is_cancelled(f->cancel)) f->cancelled = 1;
+		if (f->cancelled) return;
+		if (!pp->oriented || depth >= LVL_PVS_MAX_DEPTH || f->steps > LVL_PVS_MAX_STEPS) {
+			lvl_pvs_flood(f, next_chunk_index);
+			continue;
+		}
+
+		struct lvl_pvs_plane plane = side == 0 ? pp->plane : lvl_pvs_plane_flip(pp->plane);
+		struct lvl_pvs_winding target = pp->winding;
+		if (source != NULL) {
+			lvl_pvs_clip(&target, source_plane);
+			if (pass != NULL && target.n >= 3) {
+				lvl_pvs_clip(&target, pass_plane);
+				lvl_pvs_clip_to_separators(source, pass, 1, &target);
+				lvl_pvs_clip_to_separators(pass, source, 0, &target);
+			}
+			if (target.n < 3) continue;
+		}
+
+		lvl_pvs_mark(f, next_chunk_index);
+		f->on_stack[portal_index] = 1;
+		if (source == NULL) {
+			lvl_pvs_recurse(f, next_chunk_index, depth + 1, &target, &plane, NULL, NULL);
+		} else {
+			lvl_pvs_recurse(f, next_chunk_index, depth + 1, source, source_plane, &target, &plane);
+		}
+		f->on_stack[portal_index] = 0;
+	}
+}
+
+static void lvl_pvs_build_range(void* usr, int begin, int end)
+{
+	struct lvl_pvs_build* b = usr;
+	struct lvl* lvl = b->lvl;
+	struct lvl_pvs_flow f;
+	f.lvl = lvl;
+	f.portals = b->portals;
+	f.cancel = b->cancel;
+	f.cancelled = 0;
+	f.on_stack = calloc(lvl->n_portals + lvl->n_chunks, 1);
+	AN(f.on_stack);
+	f.flooded = f.on_stack + lvl->n_portals;
+	for (int i = begin; i < end && !f.cancelled; i++) {
+		if (lvl_pvs_is_cancelled(f.cancel)) break;
+		memset(f.on_stack, 0, lvl->n_portals + lvl->n_chunks);
+		f.row = &lvl->pvs[i * lvl->pvs_words];
+		f.steps = 0;
+		lvl_pvs_mark(&f, i);
+		lvl_pvs_recurse(&f, i, 0, NULL, NULL, NULL, NULL);
+	}
+	free(f.on_stack);
+}
+
+// which side of plane the chunk's vertices are on: -1 behind, 1 in front,
+// 0 both or neither
+static int lvl_pvs_chunk_side(struct lvl_chunk* chunk, const struct lvl_pvs_plane* plane)
+{
+	int n_behind = 0;
+	int n_front = 0;
+	for (int i = 0; i < chunk->n_vertices; i++) {
+		float d = lvl_pvs_plane_distance(plane, chunk->vertices[i].co);
+		if (d < -LVL_PVS_EPSILON) n_behind++;
+		if (d > LVL_PVS_EPSILON) n_front++;
+	}
+	if (n_behind > 0 && n_front == 0) return -1;
+	if (n_front > 0 && n_behind == 0) return 1;
+	return 0;
+}
+
+int lvl_build_pvs(struct lvl* lvl, int* cancel)
+{
+	TRACE_BEGIN("lvl_build_pvs");
+
+	if (lvl->pvs == NULL) {
+		lvl->pvs_words = (lvl->n_chunks + 31) >> 5;
+		lvl->pvs = scratch_alloc_a8(&lvl->scratch, sizeof(*lvl->pvs) * lvl->pvs_words * lvl->n_chunks);
+	}
+	memset(lvl->pvs, 0, sizeof(*lvl->pvs) * lvl->pvs_words * lvl->n_chunks);
+
+	struct lvl_pvs_build b;
+	b.lvl = lvl;
+	b.cancel = cancel;
+	b.portals = malloc(sizeof(*b.portals) * (lvl->n_portals > 0 ? lvl->n_portals : 1));
+	AN(b.portals);
+	for (int i = 0; i < lvl->n_portals; i++) {
+		struct lvl_portal* portal = lvl_get_portal(lvl, i);
+		struct lvl_pvs_portal* pp = &b.portals[i];
+		pp->oriented = 0;
+
+		struct lvl_chunk* chunk0 = lvl_get_chunk(lvl, portal->chunk_indices[0]);
+		int n = portal->n_convex_vertex_pairs;
+		if (n < 3 || n > LVL_PVS_MAX_WINDING) continue;
+		pp->winding.n = n;
+		for (int j = 0; j < n; j++) pp->winding.v[j] = chunk0->vertices[portal->vertex_pairs[j*2]].co;
+
+		// newell's method; robust against collinear vertices
+		union vec3 normal = vec3_xyz(0, 0, 0);
+		union vec3 center = vec3_xyz(0, 0, 0);
+		for (int j = 0; j < n; j++) {
+			union vec3 a = pp->winding.v[j];
+			union vec3 c = pp->winding.v[(j+1) % n];
+			normal.x += (a.y - c.y) * (a.z + c.z);
+			normal.y += (a.z - c.z) * (a.x + c.x);
+			normal.z += (a.x - c.x) * (a.y + c.y);
+			center = vec3_add(center, vec3_scale(a, 1.0f / n));
+		}
+		float length = vec3_length(normal);
+		if (length < LVL_PVS_EPSILON) continue;
+		pp->plane.normal = vec3_scale(normal, 1.0f / length);
+		pp->plane.distance = vec3_dot(pp->plane.normal, center);
+
+		int side0 = lvl_pvs_chunk_side(chunk0, &pp->plane);
+		int side1 = lvl_pvs_chunk_side(lvl_get_chunk(lvl, portal->chunk_indices[1]), &pp->plane);
+		if (side0 == 0 || side1 != -side0) continue;
+		if (side0 > 0) pp->plane = lvl_pvs_plane_flip(pp->plane);
+		pp->oriented = 1;
+	}
+
+	job_parallel_for(lvl->n_chunks, 1, lvl_pvs_build_range, &b);
+
+	free(b.portals);
+
+	TRACE_END("lvl_build_pvs");
+	return !lvl_pvs_is_cancelled(cancel);
+}
+
+static int lvl_contact_cache_is_valid(struct lvl* lvl, struct lvl_contact_cache* cache, uint32_t chunk_index)
+{
+	return
+		cache->lvl_serial == lvl->serial
+		&& cache->chunk_index == chunk_index
+		&& cache->chunk_revision == lvl_get_chunk(lvl, chunk_index)->revision;
+}
+
+static int aabb_contains(struct aabb outer, struct aabb inner)
+{
+	for (int k = 0; k < 3; k++) {
+		if ((fabsf(inner.center.s[k] - outer.center.s[k]) + inner.extent.s[k]) >= outer.extent.s[k]) return 0;
+	}
+	return 1;
+}
+
+static int lvl_bvh_node_overlaps(struct lvl_bvh_node* node, struct aabb aabb)
+{
+	for (int k = 0; k < 3; k++) {
+		if (node->min[k] > (aabb.center.s[k] + aabb.extent.s[k])) return 0;
+		if (node->max[k] < (aabb.center.s[k] - aabb.extent.s[k])) return 0;
+	}
+	return 1;
+}
+
+// refill the cache with the chunk's polygons overlapping aabb grown by
+// LVL_CONTACT_CACHE_MARGIN
+static void lvl_contact_cache_gather(struct lvl* lvl, struct lvl_contact_cache* cache, uint32_t chunk_index, struct aabb aabb)
+{
+	COUNTER_ADD(COUNTER_CONTACT_GATHERS, 1);
+
+	struct lvl_chunk* chunk = lvl_get_chunk(lvl, chunk_index);
+	cache->lvl_serial = lvl->serial;
+	cache->chunk_index = chunk_index;
+	cache->chunk_revision = chunk->revision;
+	cache->aabb = aabb;
+	for (int k = 0; k < 3; k++) cache->aabb.extent.s[k] += LVL_CONTACT_CACHE_MARGIN;
+	cache->n_polygons = 0;
+	cache->has_ground = 0;
+
+	if (chunk->n_bvh_nodes == 0) return;
+
+	uint32_t stack[LVL_BVH_MAX_DEPTH + 1];
+	int sp = 0;
+	stack[sp++] = 0;
+	while (sp > 0) {
+		uint32_t node_index = stack[--sp];
+		struct lvl_bvh_node* node = &chunk->bvh_nodes[node_index];
+		if (!lvl_bvh_node_overlaps(node, cache->aabb)) continue;
+		if (node->count == 0) {
+			stack[sp++] = node->offset;
+			stack[sp++] = node_index + 1;
+			continue;
+		}
+		for (int i = 0; i < node->count; i++) {
+			if (cache->n_polygons == LVL_CONTACT_CACHE_MAX_POLYGONS) {
+				// too crowded; queries fall back to full scans
+				cache->n_polygons = -1;
+				return;
+			}
+			cache->polygons[cache->n_polygons++] = chunk->bvh_polygons[node->offset + i];
+		}
+	}
+
+	// keep polygon list order, so that contacts resolve in the same order
+	// as a full scan would
+	for (int i = 1; i < cache->n_polygons; i++) {
+		uint32_t v = cache->polygons[i];
+		int j = i;
+		for (; j > 0 && cache->polygons[j-1] > v; j--) cache->polygons[j] = cache->polygons[j-1];
+		cache->polygons[j] = v;
+	}
+}
+
+// makes sure the contact cache covers everything the entity may query this
+// tick: its aabb plus step-up probes
+static void lvl_entity_refresh_contacts(struct lvl* lvl, struct lvl_entity* e)
+{
+	struct aabb need = lvl_entity_aabb(e);
+	float pad = lvl_entity_max_step_up(e) + 0.05f;
+	for (int k = 0; k < 3; k++) need.extent.s[k] += pad;
+
+	struct lvl_contact_cache* cache = &e->contacts;
+	if (lvl_contact_cache_is_valid(lvl, cache, e->chunk_index) && aabb_contains(cache->aabb, need)) return;
+	lvl_contact_cache_gather(lvl, cache, e->chunk_index, need);
+}
+
 struct lvl_aabb_mtv_iterator {
 	// setup
 	struct lvl* lvl;
 	struct aabb aabb;
 	uint32_t origin_chunk_index;
+	struct lvl_contact_cache* cache; // may be NULL
 
 	// state
-	int polygon_list_cursor;
+	int started;
+	int cursor; // into the chunk's collision_polygons, or the cache
+	uint32_t* cached; // NULL: full scan
+	int n;
 
 	// result
 	uint32_t material_index;
@@ -255,11 +1099,13 @@ inline static void lvl_aabb_mtv_iterator_init(struct lvl_aabb_mtv_iterator* it,
 inline static void lvl_aabb_mtv_iterator_init_from_entity(struct lvl_aabb_mtv_iterator* it, struct lvl* lvl, struct lvl_entity* e)
 {
 	lvl_aabb_mtv_iterator_init(it, lvl, lvl_entity_aabb(e), e->chunk_index);
+	it->cache = &e->contacts;
 }
 
 inline static void lvl_aabb_mtv_iterator_init_from_other_iterator(struct lvl_aabb_mtv_iterator* it, struct lvl_aabb_mtv_iterator* other)
 {
 	lvl_aabb_mtv_iterator_init(it, other->lvl, other->aabb, other->origin_chunk_index);
+	it->cache = other->cache;
 }
 
 inline static void lvl_aabb_mtv_iterator_init_from_entity_and_offset(struct lvl_aabb_mtv_iterator* it, struct lvl* lvl, struct lvl_entity* e, union vec3 offset)
@@ -269,6 +1115,23 @@ inline static void lvl_aabb_mtv_iterator_init_from_entity_and_offset(struct lvl_
 	struct aabb aabb = lvl_entity_aabb(e);
 	aabb.center = vec3_add(aabb.center, offset);
 	lvl_aabb_mtv_iterator_init(it, lvl, aabb, e->chunk_index);
+	it->cache = &e->contacts;
+}
+
+// picks the polygons to test on the first _next() call, so callers may still
+// move it->aabb after init. the cache is only read here, never refilled;
+// see lvl_entity_refresh_contacts()
+inline static void lvl_aabb_mtv_iterator_start(struct lvl_aabb_mtv_iterator* it, struct lvl_chunk* chunk)
+{
+	it->started = 1;
+	it->cached = NULL;
+	it->n = chunk->n_collision_polygons;
+	struct lvl_contact_cache* cache = it->cache;
+	if (cache == NULL || cache->n_polygons < 0) return;
+	if (!lvl_contact_cache_is_valid(it->lvl, cache, it->origin_chunk_index)) return;
+	if (!aabb_contains(cache->aabb, it->aabb)) return;
+	it->cached = cache->polygons;
+	it->n = cache->n_polygons;
 }
 
 inline static int lvl_aabb_mtv_iterator_next(struct lvl_aabb_mtv_iterator* it)
@@ -276,23 +1139,38 @@ inline static int lvl_aabb_mtv_iterator_next(struct lvl_aabb_mtv_iterator* it)
 	struct lvl_chunk* chunk = lvl_get_chunk(it->lvl, it->origin_chunk_index); // FIXME aabb may intersect portals into other chunks
 
 	AN(chunk);
-	AN(chunk->polygon_list);
-
-	while (1) {
-		uint32_t vertex_count = chunk->polygon_list[it->polygon_list_cursor++];
-		if (vertex_count == 0) break;
-
-		it->material_index = chunk->polygon_list[it->polygon_list_cursor++];
-
-		ASSERT(vertex_count <= 32);
-
-		union vec3 polygon[32];
-		for (int i = 0; i < vertex_count; i++) {
-			struct lvl_vertex lv = chunk->vertices[chunk->polygon_list[it->polygon_list_cursor++]];
-			polygon[i] = lv.co;
+	AN(chunk->collision_polygon_list);
+
+	if (!it->started) lvl_aabb_mtv_iterator_start(it, chunk);
+
+	while (it->cursor < it->n) {
+		int polygon_index = it->cached ? it->cached[it->cursor] : it->cursor;
+		it->cursor++;
+		struct lvl_polygon* p = &chunk->collision_polygons[polygon_index];
+		COUNTER_ADD(COUNTER_MTV_POLYGONS, 1);
+
+		// the aabb must straddle the plane or touch its front side;
+		// polygon_aabb_mtv() rejects the rest too, but this needs no
+		// vertices. the slack keeps it conservative
+		float s = vec3_dot(p->normal, it->aabb.center) - p->distance;
+		float e = 0;
+		for (int k = 0; k < 3; k++) e += it->aabb.extent.s[k] * fabsf(p->normal.s[k]);
+		float slack = 1e-3f * (1.0f + fabsf(p->distance));
+		if (s < -slack || s > (e + slack)) continue;
+
+		it->material_index = p->material_index;
+
+		ASSERT(p->n_vertices <= LVL_MAX_COLLISION_POLYGON_VERTICES);
+		union vec3 polygon[LVL_MAX_COLLISION_POLYGON_VERTICES];
+		for (int i = 0; i < p->n_vertices; i++) {
+			polygon[i] = chunk->collision_vertices[chunk->collision_polygon_list[p->offset + i]];
 		}
 
-		if (polygon_aabb_mtv(it->aabb, polygon, vertex_count, &it->mtv)) return 1;
+		COUNTER_ADD(COUNTER_SAT_TESTS, 1);
+		if (polygon_aabb_mtv(it->aabb, polygon, p->n_vertices, &it->mtv)) {
+			COUNTER_ADD(COUNTER_SAT_HITS, 1);
+			return 1;
+		}
 	}
 
 	// TODO check against portals (need a smallish stack?)
@@ -310,13 +1188,17 @@ static void lvl_entity_clipmove(struct lvl* lvl, struct lvl_entity* e, union vec
 	float rlensqr = vec3_dot(r, r);
 	if (rlensqr < 1e-5) return;
 
+	TRACE_BEGIN("lvl_entity_clipmove");
+
 	int n_steps = 8; // TODO determine based on length of r?
 	union vec3 rstep = vec3_scale(r, 1.0 / (float)n_steps);
 
 	float max_step_up = lvl_entity_max_step_up(e);
 
 	for (int i = 0; i < n_steps; i++) {
+		COUNTER_ADD(COUNTER_CLIPMOVE_SUBSTEPS, 1);
 		e->position = vec3_add(e->position, rstep);
+		lvl_entity_refresh_contacts(lvl, e);
 		struct lvl_aabb_mtv_iterator it;
 		lvl_aabb_mtv_iterator_init_from_entity(&it, lvl, e);
 		while (lvl_aabb_mtv_iterator_next(&it)) {
@@ -334,6 +1216,7 @@ static void lvl_entity_clipmove(struct lvl* lvl, struct lvl_entity* e, union vec
 					float t = 0.5f;
 					float tinc = 0.25f;
 					for (int i = 0; i < N; i++) {
+						COUNTER_ADD(COUNTER_STEP_UP_PROBES, 1);
 						struct lvl_aabb_mtv_iterator it2;
 						lvl_aabb_mtv_iterator_init_from_other_iterator(&it2, &it);
 						union vec3 step_up_probe = vec3_add(vec3_scale(s, max_step_up * t), nudge);
@@ -377,22 +1260,53 @@ static void lvl_entity_clipmove(struct lvl* lvl, struct lvl_entity* e, union vec
 			}
 		}
 	}
+
+	TRACE_END("lvl_entity_clipmove");
 }
 
 void lvl_entity_update(struct lvl* lvl, struct lvl_entity* e, float dt)
 {
-	// ground check
-	union vec3 ground_offset = vec3_scale(lvl->gravity_normalized, 3e-3);
-	struct lvl_aabb_mtv_iterator it;
-	lvl_aabb_mtv_iterator_init_from_entity_and_offset(&it, lvl, e, ground_offset);
+	struct lvl_contact_cache* cache = &e->contacts;
+	int has_input = e->move_forward != 0 || e->move_right != 0 || e->move_jump != 0;
+
+	// sleeping entities stay put until woken by input, a push, a teleport
+	// or a change to their chunk
+	if (e->sleeping) {
+		if (
+			!has_input
+			&& lvl_contact_cache_is_valid(lvl, cache, e->chunk_index)
+			&& memcmp(&e->position, &cache->ground_position, sizeof(e->position)) == 0
+		) {
+			COUNTER_ADD(COUNTER_SLEEPING_UPDATES, 1);
+			return;
+		}
+		e->sleeping = 0;
+	}
+
+	TRACE_BEGIN("lvl_entity_update");
+
+	lvl_entity_refresh_contacts(lvl, e);
+
+	// ground check; reuses last tick's result if the entity hasn't moved
 	union vec3 dominant_ground_mtv = {{0,0,0}};
 	float dominant_ground_mtv_sqrlen = 0;
-	while (lvl_aabb_mtv_iterator_next(&it)) {
-		float sqrlen = vec3_dot(it.mtv, it.mtv);
-		if (sqrlen > dominant_ground_mtv_sqrlen) {
-			dominant_ground_mtv_sqrlen = sqrlen;
-			dominant_ground_mtv = it.mtv;
+	if (cache->has_ground && memcmp(&e->position, &cache->ground_position, sizeof(e->position)) == 0) {
+		dominant_ground_mtv = cache->ground_mtv;
+		dominant_ground_mtv_sqrlen = vec3_dot(dominant_ground_mtv, dominant_ground_mtv);
+	} else {
+		union vec3 ground_offset = vec3_scale(lvl->gravity_normalized, 3e-3);
+		struct lvl_aabb_mtv_iterator it;
+		lvl_aabb_mtv_iterator_init_from_entity_and_offset(&it, lvl, e, ground_offset);
+		while (lvl_aabb_mtv_iterator_next(&it)) {
+			float sqrlen = vec3_dot(it.mtv, it.mtv);
+			if (sqrlen > dominant_ground_mtv_sqrlen) {
+				dominant_ground_mtv_sqrlen = sqrlen;
+				dominant_ground_mtv = it.mtv;
+			}
 		}
+		cache->has_ground = 1;
+		cache->ground_position = e->position;
+		cache->ground_mtv = dominant_ground_mtv;
 	}
 
 	e->grounded = 0;
@@ -441,6 +1355,19 @@ void lvl_entity_update(struct lvl* lvl, struct lvl_entity* e, float dt)
 	e->move_jump = 0;
 
 	lvl_entity_clipmove(lvl, e, vec3_scale(e->velocity, dt));
+
+	if (
+		e->grounded
+		&& !has_input
+		&& vec3_dot(e->velocity, e->velocity) < (LVL_ENTITY_SLEEP_SPEED * LVL_ENTITY_SLEEP_SPEED)
+		&& lvl_contact_cache_is_valid(lvl, cache, e->chunk_index)
+		&& memcmp(&e->position, &cache->ground_position, sizeof(e->position)) == 0
+	) {
+		e->sleeping = 1;
+		e->velocity = vec3_xyz(0, 0, 0);
+	}
+
+	TRACE_END("lvl_entity_update");
 }
 
 struct mat44 lvl_entity_view(struct lvl_entity* e)
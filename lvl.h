@@ -10,6 +10,36 @@ struct lvl_vertex {
 	union vec2 uv;
 };
 
+struct lvl_instance {
+	uint32_t mesh_index;
+	struct mat44 transform;
+};
+
+/*
+random-access view of an encoded polygon list (see lvl_chunk), one entry per
+polygon, built by lvl_chunk_finalize()/lvl_mesh_finalize()
+*/
+struct lvl_polygon {
+	uint32_t offset; // polygon list index of the first vertex index
+	uint32_t n_vertices;
+	uint32_t material_index;
+	union vec3 normal; // front facing, same winding as polygon_aabb_mtv()
+	float distance; // plane: dot(normal, p) == distance
+};
+
+/*
+bounding volume hierarchy over a chunk's polygons. nodes are stored depth
+first, so an inner node's first child directly follows it.
+*/
+#define LVL_BVH_LEAF_SIZE (4)
+#define LVL_BVH_MAX_DEPTH (64)
+struct lvl_bvh_node {
+	float min[3];
+	float max[3];
+	uint32_t offset; // leaf: first index into bvh_polygons; inner: index of second child
+	uint32_t count; // leaf: number of polygons; 0 for inner nodes
+};
+
 struct lvl_chunk {
 	int n_vertices;
 	struct lvl_vertex* vertices;
@@ -20,12 +50,48 @@ struct lvl_chunk {
 	  material index
 	  vertex indices...
 	  ...
-	  (sort by material index if you're a nice guy)
+	  polygons are in vertex cache / spatial locality order
+	  (lua/locality.lua), NOT grouped by material index. that's deliberate:
+	  render.c draws a chunk's polygons in one draw call with one shader
+	  (nullmat), so there's nothing to batch by material. once materials
+	  get their own shaders/textures, group by material first and apply
+	  locality order within each group
 	*/
 	uint32_t* polygon_list;
 
 	int n_portal_indices;
 	uint32_t* portal_indices;
+
+	// sorted by mesh index
+	int n_instances;
+	struct lvl_instance* instances;
+
+	/*
+	collision mesh; what entities collide with and rays hit. built by the
+	level compiler (lua/collision.lua) from the render polygons: coplanar
+	neighbours merged, non-solid materials dropped, hulls added.
+	collision_polygon_list is encoded like polygon_list, indexing
+	collision_vertices; its polygons have at most
+	LVL_MAX_COLLISION_POLYGON_VERTICES vertices (see
+	lvl_chunk_validate_collision_polygon_list()). see
+	lvl_init_chunk_collision()
+	*/
+	int n_collision_vertices;
+	union vec3* collision_vertices;
+	uint32_t* collision_polygon_list;
+
+	// bumped by lvl_chunk_changed(); invalidates contact caches
+	uint32_t revision;
+
+	// derived; see lvl_chunk_finalize()
+	struct aabb aabb;
+	int n_polygons;
+	struct lvl_polygon* polygons; // polygon_list
+	int n_collision_polygons;
+	struct lvl_polygon* collision_polygons; // collision_polygon_list
+	int n_bvh_nodes;
+	struct lvl_bvh_node* bvh_nodes;
+	uint32_t* bvh_polygons; // collision_polygons indices, in leaf order
 };
 
 
@@ -45,11 +111,48 @@ struct lvl_portal {
 	uint32_t* vertex_pairs;
 };
 
+// instanced prop geometry; polygon_list is encoded like lvl_chunk's
+struct lvl_mesh {
+	int n_vertices;
+	struct lvl_vertex* vertices;
+	uint32_t* polygon_list;
+
+	// derived; see lvl_mesh_finalize()
+	int n_polygons;
+	struct lvl_polygon* polygons;
+};
+
 #define LVL_MATERIAL_NAME_MAX_LENGTH (64)
 struct lvl_material {
 	char name[LVL_MATERIAL_NAME_MAX_LENGTH];
 };
 
+/*
+per-entity temporal contact cache. collision queries whose aabb fits inside
+`aabb` only test `polygons` (the chunk's polygons overlapping `aabb`) instead
+of the whole chunk; when the entity moves past the margin the set is
+gathered again around it. the last ground check result is kept as well, so
+an entity that hasn't moved reuses it. everything is dropped when the level
+(lvl->serial) or the chunk (revision) changes.
+*/
+#define LVL_CONTACT_CACHE_MAX_POLYGONS (128)
+#define LVL_CONTACT_CACHE_MARGIN (0.75f)
+struct lvl_contact_cache {
+	uint32_t lvl_serial; // 0: empty
+	uint32_t chunk_index;
+	uint32_t chunk_revision;
+	struct aabb aabb;
+	int n_polygons; // -1 if more than LVL_CONTACT_CACHE_MAX_POLYGONS
+	uint32_t polygons[LVL_CONTACT_CACHE_MAX_POLYGONS]; // collision_polygons indices
+
+	int has_ground;
+	union vec3 ground_position;
+	union vec3 ground_mtv;
+};
+
+// grounded entities slower than this, and without input, fall asleep
+#define LVL_ENTITY_SLEEP_SPEED (0.05f)
+
 struct lvl_entity {
 	uint32_t chunk_index;
 	union vec3 position;
@@ -57,6 +160,9 @@ struct lvl_entity {
 	float yaw, pitch;
 	float move_forward, move_right, move_jump;
 	uint32_t grounded:1;
+	uint32_t sleeping:1;
+
+	struct lvl_contact_cache contacts;
 };
 
 struct lvl {
@@ -71,15 +177,31 @@ struct lvl {
 	int n_materials;
 	struct lvl_material* materials;
 
+	int n_meshes;
+	struct lvl_mesh* meshes;
+
 	union vec3 gravity, gravity_normalized;
+
+	uint32_t serial; // unique per lvl_init()
+
+	/*
+	potentially visible set; derived, see lvl_build_pvs(). one row of
+	pvs_words words per chunk; bit `to` of row `from` is set if anything in
+	chunk `to` may be visible from anywhere in chunk `from`. conservative:
+	a clear bit means certainly not visible
+	*/
+	int pvs_words;
+	uint32_t* pvs;
 };
 
 
-void lvl_init(struct lvl* lvl, int n_chunks, int n_portals, int n_materials);
+void lvl_init(struct lvl* lvl, int n_chunks, int n_portals, int n_materials, int n_meshes);
 void lvl_free(struct lvl* lvl);
 
 struct lvl_chunk* lvl_get_chunk(struct lvl* lvl, uint32_t chunk_index);
-struct lvl_chunk* lvl_init_chunk(struct lvl* lvl, int chunk_index, int n_vertices, int polygon_list_size, int n_portal_indices);
+struct lvl_chunk* lvl_init_chunk(struct lvl* lvl, int chunk_index, int n_vertices, int polygon_list_size, int n_portal_indices, int n_instances);
+struct lvl_chunk* lvl_init_chunk_collision(struct lvl* lvl, int chunk_index, int n_vertices, int polygon_list_size);
+void lvl_chunk_collision_from_render(struct lvl* lvl, int chunk_index); // when the compiler provided none
 
 struct lvl_portal* lvl_get_portal(struct lvl* lvl, uint32_t portal_index);
 struct lvl_portal* lvl_init_portal(struct lvl* lvl, int portal_index, int n_convex_vertex_pairs, int n_additional_vertex_pairs);
@@ -87,12 +209,84 @@ struct lvl_portal* lvl_init_portal(struct lvl* lvl, int portal_index, int n_conv
 struct lvl_material* lvl_get_material(struct lvl* lvl, uint32_t material_index);
 int lvl_get_material_index(struct lvl* lvl, const char* name); // -1 if not found
 
+struct lvl_mesh* lvl_get_mesh(struct lvl* lvl, uint32_t mesh_index);
+struct lvl_mesh* lvl_init_mesh(struct lvl* lvl, int mesh_index, int n_vertices, int polygon_list_size);
+
+int lvl_validate_polygon_list(struct lvl* lvl, uint32_t* polygon_list, int n_vertices, int polygon_list_size, char* errstr1024);
 int lvl_chunk_validate_polygon_list(struct lvl* lvl, struct lvl_chunk* chunk, int n_vertices, int polygon_list_size, char* errstr1024);
+// collision polygons, and portals' convex vertex pairs, are gathered into
+// fixed size arrays by collision and ray queries
+#define LVL_MAX_COLLISION_POLYGON_VERTICES (32)
+int lvl_chunk_validate_collision_polygon_list(struct lvl* lvl, struct lvl_chunk* chunk, int n_vertices, int polygon_list_size, char* errstr1024);
+void lvl_chunk_finalize(struct lvl* lvl, struct lvl_chunk* chunk); // call after chunk and its collision mesh are populated and validated
+void lvl_mesh_finalize(struct lvl* lvl, struct lvl_mesh* mesh); // call after mesh is populated and validated
 int lvl_validate_misc(struct lvl* lvl, char* errstr1024);
+void lvl_chunk_changed(struct lvl* lvl, uint32_t chunk_index); // call after editing chunk geometry; wakes entities in it
+
+/*
+builds lvl->pvs by portal flow: sight lines out of a chunk are followed
+through chains of portals, each portal clipped to the planes of the first
+(source) and latest (pass) portal of the chain and to the planes separating
+those two. a portal that doesn't separate its chunks cleanly (both chunks
+have vertices on one side of it), chains deeper than LVL_PVS_MAX_DEPTH and
+source chunks exceeding LVL_PVS_MAX_STEPS fall back to portal graph
+reachability. spread over the job system (job.h), one source chunk per job.
+call after all chunks and portals are populated. cancel may be NULL; once
+*cancel is set, the build stops early and returns 0, leaving an incomplete
+(not conservative) pvs that must not be used
+*/
+#define LVL_PVS_MAX_WINDING (64)
+#define LVL_PVS_MAX_DEPTH (32)
+#define LVL_PVS_MAX_STEPS (1<<16)
+#define LVL_PVS_EPSILON (1e-3f)
+int lvl_build_pvs(struct lvl* lvl, int* cancel);
+
+// 1 if anything in chunk `to` may be visible from chunk `from`; always 1
+// without a pvs
+inline static int lvl_chunk_maybe_visible(struct lvl* lvl, uint32_t from, uint32_t to)
+{
+	if (lvl->pvs == NULL) return 1;
+	ASSERT(from < lvl->n_chunks && to < lvl->n_chunks);
+	return (lvl->pvs[from * lvl->pvs_words + (to >> 5)] >> (to & 31)) & 1;
+}
+
+/*
+ray queries. rays start in chunk_index and continue through portals into
+neighbouring chunks (portals are assumed to join chunks in a common space,
+as the welded vertex pairs imply). polygons are hit from either side; the
+returned normal faces the ray origin.
+*/
+#define LVL_RAYCAST_MAX_CHUNKS (64) // max portal crossings per ray
+
+struct lvl_ray {
+	uint32_t chunk_index;
+	union vec3 origin;
+	union vec3 direction; // need not be normalized
+	float max_distance;
+};
+
+struct lvl_ray_hit {
+	uint32_t chunk_index;
+	uint32_t polygon; // index into the chunk's collision_polygons
+	uint32_t material_index;
+	float distance;
+	union vec3 point;
+	union vec3 normal;
+};
+
+// return 1 and fill in hit if something was hit
+int lvl_raycast(struct lvl* lvl, uint32_t chunk_index, union vec3 origin, union vec3 direction, float max_distance, struct lvl_ray_hit* hit);
+int lvl_segment_cast(struct lvl* lvl, uint32_t chunk_index, union vec3 from, union vec3 to, struct lvl_ray_hit* hit);
+// hits[i] is valid where results[i] is 1; spread over the job system (job.h)
+void lvl_raycast_batch(struct lvl* lvl, int n, struct lvl_ray* rays, struct lvl_ray_hit* hits, int* results);
+// line of sight between two points, e.g. for AI; the pvs rejects most
+// chunk pairs before any ray is cast
+int lvl_can_see(struct lvl* lvl, uint32_t from_chunk_index, union vec3 from, uint32_t to_chunk_index, union vec3 to);
 
 void lvl_entity_dlook(struct lvl_entity* e, float dyaw, float dpitch);
 void lvl_entity_move(struct lvl_entity* e, float forward, float right, float jump);
 void lvl_entity_accelerate(struct lvl_entity* e, union vec3 a, float dt);
+void lvl_entity_wake(struct lvl_entity* e);
 void lvl_entity_update(struct lvl* lvl, struct lvl_entity* e, float dt);
 //void lvl_entity_flymove(struct lvl* lvl, struct lvl_entity* e, float forward, float right);
 
@@ -1,9 +1,18 @@
 #include <stdio.h>
+#include <string.h>
 
 #include <SDL.h>
 
 #include "llvl.h"
 #include "render.h"
+#include "prof.h"
+#include "headless.h"
+#include "frame.h"
+#include "job.h"
+#include "demo.h"
+#include "trace.h"
+#include "counters.h"
+#include "pace.h"
 #include "a.h"
 
 static void gldbg(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* usr)
@@ -11,9 +20,87 @@ static void gldbg(GLenum source, GLenum type, GLuint id, GLenum severity, GLsize
 	printf("<gldbg> %d %d %d %d %s\n", source, type, id, severity, message);
 }
 
+// late latch: mouse motion that arrived after this frame's event drain is
+// applied to the rendered view only. the events stay queued and reach the
+// sim next frame as usual, so the sim orientation remains authoritative
+static void late_latch_look(struct lvl_entity* view)
+{
+	SDL_PumpEvents();
+	SDL_Event events[64];
+	int n = SDL_PeepEvents(events, 64, SDL_PEEKEVENT, SDL_MOUSEMOTION, SDL_MOUSEMOTION);
+	int mdx = 0;
+	int mdy = 0;
+	for (int i = 0; i < n; i++) {
+		mdx += events[i].motion.xrel;
+		mdy += events[i].motion.yrel;
+	}
+	demo_apply_look(view, mdx, mdy);
+}
+
 int main(int argc, char** argv)
 {
 	int enable_opengl_debug = 0;
+	int enable_pacing = 1;
+	const char* plan = "thing";
+	const char* prof_csv_path = NULL;
+	const char* record_path = NULL;
+	const char* trace_path = NULL;
+	const char* counters_csv_path = NULL;
+	int headless = 0;
+	struct headless_options headless_options;
+	headless_options_default(&headless_options);
+
+	for (int i = 1; i < argc; i++) {
+		int has_value = (i+1) < argc;
+		if (strcmp(argv[i], "--prof-csv") == 0 && has_value) {
+			prof_csv_path = argv[++i];
+		} else if (strcmp(argv[i], "--plan") == 0 && has_value) {
+			plan = argv[++i];
+			// recorded into demos
+			if (strlen(plan) >= DEMO_PLAN_MAX_LENGTH) arghf("--plan: plan name too long (max %d)", DEMO_PLAN_MAX_LENGTH-1);
+		} else if (strcmp(argv[i], "--headless") == 0) {
+			headless = 1;
+		} else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+			headless_options.n_frames = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--size") == 0 && has_value) {
+			if (sscanf(argv[++i], "%dx%d", &headless_options.width, &headless_options.height) != 2) {
+				arghf("--size expects <width>x<height>");
+			}
+		} else if (strcmp(argv[i], "--frame-hash") == 0) {
+			headless_options.frame_hash = 1;
+		} else if (strcmp(argv[i], "--no-pace") == 0) {
+			enable_pacing = 0;
+		} else if (strcmp(argv[i], "--counters-csv") == 0 && has_value) {
+			counters_csv_path = argv[++i];
+		} else if (strcmp(argv[i], "--trace") == 0 && has_value) {
+			trace_path = argv[++i];
+		} else if (strcmp(argv[i], "--record") == 0 && has_value) {
+			record_path = argv[++i];
+		} else if (strcmp(argv[i], "--replay") == 0 && has_value) {
+			headless = 1;
+			headless_options.replay = argv[++i];
+		} else {
+			fprintf(stderr, "usage: %s [--plan <name>[:<key>=<value>,...]] [--no-pace] [--prof-csv <path>] [--counters-csv <path>] [--trace <path>] [--record <path>] [--headless [--frames <n>] [--size <w>x<h>] [--frame-hash]] [--replay <path>]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	headless_options.plan = plan;
+
+	if (trace_path) trace_open(trace_path);
+	if (counters_csv_path) counters_csv_open(counters_csv_path);
+	TRACE_THREAD_NAME("main");
+
+	// the main thread is worker 0
+	job_init(SDL_GetCPUCount() - 1);
+
+	if (headless) {
+		int status = headless_run(&headless_options);
+		job_free();
+		trace_close();
+		counters_csv_close();
+		return status;
+	}
 
 	SAZ(SDL_Init(SDL_INIT_EVERYTHING));
 	atexit(SDL_Quit);
@@ -42,11 +129,29 @@ int main(int argc, char** argv)
 
 	SAZ(SDL_GL_SetSwapInterval(1)); // or -1, "late swap tearing"?
 
+	struct pace pace;
+	{
+		SDL_DisplayMode mode;
+		int refresh_hz = 0;
+		if (enable_pacing && SDL_GetWindowDisplayMode(window, &mode) == 0) refresh_hz = mode.refresh_rate;
+		pace_init(&pace, refresh_hz);
+	}
+
 	struct render render;
 	render_init(&render, window);
 
+	prof_init(1);
+	if (prof_csv_path) prof_csv_open(prof_csv_path);
+	frame_init(1<<20);
+	int show_prof_overlay = 0;
+
+	// the level is built in the background; until it's ready, and while
+	// the next one is being built, frames keep going
 	struct lvl lvl;
-	llvl_build("thing", &lvl);
+	int has_lvl = 0;
+	struct llvl_load load;
+	memset(&load, 0, sizeof(load));
+	llvl_load_start(&load, plan);
 
 	int ctrl_forward = 0;
 	int ctrl_backward = 0;
@@ -61,8 +166,19 @@ int main(int argc, char** argv)
 
 	float dt = 1.0 / 60.0f;
 
+	// recording starts with the first level, and stops if it's replaced,
+	// since a replay always starts from a fresh entity
+	struct demo demo;
+	int recording = 0;
+
 	int exiting = 0;
 	while (!exiting) {
+		frame_begin();
+		prof_frame_begin();
+		pace_wait(&pace);
+		uint64_t input_ns = prof_ns();
+		uint64_t latch_ns = 0;
+
 		int mdx = 0;
 		int mdy = 0;
 
@@ -76,6 +192,21 @@ int main(int argc, char** argv)
 				if (e.key.keysym.sym == SDLK_ESCAPE) {
 					exiting = 1;
 				}
+				if (e.key.keysym.sym == SDLK_F5 && !e.key.repeat) {
+					// reload; restarts a load in progress
+					llvl_load_cancel(&load);
+					llvl_load_start(&load, plan);
+				}
+				if (e.key.keysym.sym == SDLK_F4 && !e.key.repeat) {
+					trace_flush();
+				}
+				if (e.key.keysym.sym == SDLK_F3 && !e.key.repeat) {
+					show_prof_overlay = !show_prof_overlay;
+					if (show_prof_overlay) {
+						prof_dump(stdout);
+						counters_dump(stdout);
+					}
+				}
 			}
 
 			struct push_key {
@@ -102,27 +233,88 @@ int main(int argc, char** argv)
 			}
 		}
 
-		{
-			float sensitivity = 0.1f;
-			float dyaw = (float)mdx * sensitivity;
-			float dpitch = (float)mdy * sensitivity;
-			lvl_entity_dlook(&view_entity, dyaw, dpitch);
-		}
+		struct demo_input input;
+		input.buttons =
+			(ctrl_forward ? DEMO_FORWARD : 0) |
+			(ctrl_backward ? DEMO_BACKWARD : 0) |
+			(ctrl_left ? DEMO_LEFT : 0) |
+			(ctrl_right ? DEMO_RIGHT : 0) |
+			(ctrl_jump ? DEMO_JUMP : 0);
+		input.mdx = mdx < INT16_MIN ? INT16_MIN : mdx > INT16_MAX ? INT16_MAX : mdx;
+		input.mdy = mdy < INT16_MIN ? INT16_MIN : mdy > INT16_MAX ? INT16_MAX : mdy;
+		ctrl_jump = 0;
 
 		{
-			float forward = (float)(ctrl_forward - ctrl_backward);
-			float right = (float)(ctrl_right - ctrl_left);
-			lvl_entity_move(&view_entity, forward, right, ctrl_jump ? 1.0 : 0.0);
-			ctrl_jump = 0;
+			struct lvl next_lvl;
+			struct llvl_build_stats build_stats;
+			int load_state = llvl_load_poll(&load, &next_lvl, &build_stats);
+			if (load_state == LLVL_LOAD_FAILED) {
+				fprintf(stderr, "level load failed: %s\n", load.error);
+				if (has_lvl) fprintf(stderr, "keeping the current level\n");
+			}
+			if (load_state == LLVL_LOAD_DONE) {
+				llvl_dump_build_stats(stdout, &build_stats);
+				if (recording) {
+					demo_record_close(&demo);
+					recording = 0;
+					printf("level reloaded; recording stopped\n");
+				}
+				if (record_path && !has_lvl) {
+					demo_record_open(&demo, record_path, plan, dt);
+					recording = 1;
+				}
+
+				render_set_lvl(&render, NULL);
+				if (has_lvl) lvl_free(&lvl);
+				lvl = next_lvl;
+				has_lvl = 1;
+				render_set_lvl(&render, &lvl);
+				memset(&view_entity, 0, sizeof(view_entity));
+			}
 		}
 
-		lvl_entity_update(&lvl, &view_entity, dt);
+		if (has_lvl) {
+			prof_begin("sim");
+			demo_apply_input(&view_entity, &input);
+			lvl_entity_update(&lvl, &view_entity, dt);
+			prof_end();
+			if (recording) demo_record_tick(&demo, &input, demo_entity_hash(&view_entity));
 
-		render_lvl(&render, &lvl, &view_entity);
+			struct lvl_entity view = view_entity;
+			latch_ns = prof_ns();
+			late_latch_look(&view);
+			render_lvl(&render, &lvl, &view);
+		} else {
+			render_blank(&render);
+		}
+		if (show_prof_overlay) render_prof_overlay(&render);
+
+		pace_work_end(&pace);
+		prof_begin("swap");
 		render_flip(&render);
+		prof_end();
+		pace_swapped(&pace);
+
+		// input sampling to swap; with vsync on, the swap returns at
+		// (roughly) the vblank that starts scanning the frame out
+		prof_sample("latency_input", pace.swap_ns - input_ns);
+		if (latch_ns) prof_sample("latency_latch", pace.swap_ns - latch_ns);
+
+		prof_frame_end();
+		counters_frame_end();
+		frame_end();
+		trace_flush_if_full();
 	}
 
-	lvl_free(&lvl);
+	frame_free();
+	prof_free();
+	if (recording) demo_record_close(&demo);
+	llvl_load_cancel(&load);
+	render_set_lvl(&render, NULL);
+	if (has_lvl) lvl_free(&lvl);
+	job_free();
+	trace_close();
+	counters_csv_close();
 
 	SDL_DestroyWindow(window);
 	SDL_GL_DeleteContext(glctx);
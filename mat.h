@@ -6,6 +6,27 @@
 
 #include "a.h"
 
+/*
+vector and matrix functions with SSE (x86) or NEON (arm) paths where they
+pay off: mat44_multiply(), mat44_transform*(). the scalar versions
+(*_scalar) are always available; define MAT_NO_SIMD to use them everywhere.
+results are bit identical to the scalar versions, so the sim (and demo
+replays) don't depend on the build. that takes building with
+-ffp-contract=off (Makefile.common), since a compiler fusing the scalar
+multiply-adds into FMAs would round differently from the separate SIMD
+multiplies and adds, and no -ffast-math. vec3_normalize_fast() is the
+exception: a refined reciprocal square root estimate whose last bits
+differ between SSE, NEON and scalar builds; never use it in the sim.
+bench/bench checks the paths agree.
+*/
+#if !defined(MAT_NO_SIMD) && defined(__SSE__)
+#define MAT_SSE
+#include <xmmintrin.h>
+#elif !defined(MAT_NO_SIMD) && defined(__ARM_NEON)
+#define MAT_NEON
+#include <arm_neon.h>
+#endif
+
 #ifndef M_PI
 #define M_PI (3.141592653589793)
 #endif
@@ -31,11 +52,12 @@ union vec3 {
 	float s[3];
 };
 
+// aligned for SIMD loads; allocate arrays with scratch_alloc_a16()
 union vec4 {
 	struct { float x; float y; float z; float w; };
 	struct { float r; float g; float b; float a; };
 	float s[4];
-};
+} __attribute__((aligned(16)));
 
 struct mat33 {
 	float s[3*3];
@@ -152,6 +174,27 @@ inline static union vec3 vec3_normalize(union vec3 v)
 	return vec3_scale(v, 1.0f / vec3_length(v));
 }
 
+// within a few ulp of vec3_normalize(); not deterministic across builds
+inline static union vec3 vec3_normalize_fast(union vec3 v)
+{
+#if defined(MAT_SSE)
+	// one newton-raphson step takes the 12 bit estimate to ~23 bits
+	__m128 d = _mm_set_ss(vec3_dot(v, v));
+	__m128 y = _mm_rsqrt_ss(d);
+	__m128 yyd = _mm_mul_ss(_mm_mul_ss(y, y), d);
+	y = _mm_mul_ss(_mm_mul_ss(_mm_set_ss(0.5f), y), _mm_sub_ss(_mm_set_ss(3.0f), yyd));
+	return vec3_scale(v, _mm_cvtss_f32(y));
+#elif defined(MAT_NEON)
+	float32x2_t d = vdup_n_f32(vec3_dot(v, v));
+	float32x2_t y = vrsqrte_f32(d);
+	y = vmul_f32(y, vrsqrts_f32(vmul_f32(y, y), d));
+	y = vmul_f32(y, vrsqrts_f32(vmul_f32(y, y), d));
+	return vec3_scale(v, vget_lane_f32(y, 0));
+#else
+	return vec3_normalize(v);
+#endif
+}
+
 inline static union vec3 vec3_move(float yaw, float pitch, float forward, float right)
 {
 	union vec3 move;
@@ -177,8 +220,10 @@ inline static union vec3 vec3_move(float yaw, float pitch, float forward, float
 
 inline static float vec4_dot(union vec4 a, union vec4 b)
 {
-	float dot = 0;
-	for (int i = 0; i < 4; i++) dot += a.s[i] * b.s[i];
+	// starting from 0 would turn an all -0 sum into +0, unlike the SIMD
+	// paths, which start from the first product
+	float dot = a.s[0] * b.s[0];
+	for (int i = 1; i < 4; i++) dot += a.s[i] * b.s[i];
 	return dot;
 }
 
@@ -221,7 +266,7 @@ inline static union vec4 mat44_get_col(struct mat44 m, int col)
 	return v;
 }
 
-inline static struct mat44 mat44_multiply(struct mat44 a, struct mat44 b)
+inline static struct mat44 mat44_multiply_scalar(struct mat44 a, struct mat44 b)
 {
 	struct mat44 m;
 	for (int row = 0; row < 4; row++) {
@@ -235,6 +280,147 @@ inline static struct mat44 mat44_multiply(struct mat44 a, struct mat44 b)
 	return m;
 }
 
+/*
+columns are contiguous (see mat44_ati()), so the SIMD paths compute each
+result column as a sum of a's columns scaled by one column of b. products
+are added in the same order as vec4_dot(), so the results are identical
+*/
+inline static struct mat44 mat44_multiply(struct mat44 a, struct mat44 b)
+{
+#if defined(MAT_SSE)
+	struct mat44 m;
+	__m128 a0 = _mm_loadu_ps(&a.s[0]);
+	__m128 a1 = _mm_loadu_ps(&a.s[4]);
+	__m128 a2 = _mm_loadu_ps(&a.s[8]);
+	__m128 a3 = _mm_loadu_ps(&a.s[12]);
+	for (int col = 0; col < 4; col++) {
+		const float* bc = &b.s[col*4];
+		__m128 r = _mm_mul_ps(a0, _mm_set1_ps(bc[0]));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(bc[1])));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(bc[2])));
+		r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(bc[3])));
+		_mm_storeu_ps(&m.s[col*4], r);
+	}
+	return m;
+#elif defined(MAT_NEON)
+	struct mat44 m;
+	float32x4_t a0 = vld1q_f32(&a.s[0]);
+	float32x4_t a1 = vld1q_f32(&a.s[4]);
+	float32x4_t a2 = vld1q_f32(&a.s[8]);
+	float32x4_t a3 = vld1q_f32(&a.s[12]);
+	for (int col = 0; col < 4; col++) {
+		const float* bc = &b.s[col*4];
+		// separate multiply and add; vmlaq_f32() may be fused
+		float32x4_t r = vmulq_n_f32(a0, bc[0]);
+		r = vaddq_f32(r, vmulq_n_f32(a1, bc[1]));
+		r = vaddq_f32(r, vmulq_n_f32(a2, bc[2]));
+		r = vaddq_f32(r, vmulq_n_f32(a3, bc[3]));
+		vst1q_f32(&m.s[col*4], r);
+	}
+	return m;
+#else
+	return mat44_multiply_scalar(a, b);
+#endif
+}
+
+inline static union vec4 mat44_transform_scalar(struct mat44 m, union vec4 v)
+{
+	union vec4 r;
+	for (int row = 0; row < 4; row++) {
+		r.s[row] = vec4_dot(mat44_get_row(m, row), v);
+	}
+	return r;
+}
+
+// m * v
+inline static union vec4 mat44_transform(struct mat44 m, union vec4 v)
+{
+#if defined(MAT_SSE)
+	union vec4 r;
+	__m128 x = _mm_mul_ps(_mm_loadu_ps(&m.s[0]), _mm_set1_ps(v.s[0]));
+	x = _mm_add_ps(x, _mm_mul_ps(_mm_loadu_ps(&m.s[4]), _mm_set1_ps(v.s[1])));
+	x = _mm_add_ps(x, _mm_mul_ps(_mm_loadu_ps(&m.s[8]), _mm_set1_ps(v.s[2])));
+	x = _mm_add_ps(x, _mm_mul_ps(_mm_loadu_ps(&m.s[12]), _mm_set1_ps(v.s[3])));
+	_mm_store_ps(r.s, x);
+	return r;
+#elif defined(MAT_NEON)
+	union vec4 r;
+	float32x4_t x = vmulq_n_f32(vld1q_f32(&m.s[0]), v.s[0]);
+	x = vaddq_f32(x, vmulq_n_f32(vld1q_f32(&m.s[4]), v.s[1]));
+	x = vaddq_f32(x, vmulq_n_f32(vld1q_f32(&m.s[8]), v.s[2]));
+	x = vaddq_f32(x, vmulq_n_f32(vld1q_f32(&m.s[12]), v.s[3]));
+	vst1q_f32(r.s, x);
+	return r;
+#else
+	return mat44_transform_scalar(m, v);
+#endif
+}
+
+// m * (p, 1); no perspective divide
+inline static union vec3 mat44_transform_point(struct mat44 m, union vec3 p)
+{
+	union vec4 v = {{p.x, p.y, p.z, 1}};
+	union vec4 r = mat44_transform(m, v);
+	return vec3_xyz(r.x, r.y, r.z);
+}
+
+// out[i] = m * in[i]; in and out may be the same array
+inline static void mat44_transform_batch(struct mat44 m, int n, const union vec4* in, union vec4* out)
+{
+#if defined(MAT_SSE)
+	__m128 c0 = _mm_loadu_ps(&m.s[0]);
+	__m128 c1 = _mm_loadu_ps(&m.s[4]);
+	__m128 c2 = _mm_loadu_ps(&m.s[8]);
+	__m128 c3 = _mm_loadu_ps(&m.s[12]);
+	for (int i = 0; i < n; i++) {
+		const float* v = in[i].s;
+		__m128 x = _mm_mul_ps(c0, _mm_set1_ps(v[0]));
+		x = _mm_add_ps(x, _mm_mul_ps(c1, _mm_set1_ps(v[1])));
+		x = _mm_add_ps(x, _mm_mul_ps(c2, _mm_set1_ps(v[2])));
+		x = _mm_add_ps(x, _mm_mul_ps(c3, _mm_set1_ps(v[3])));
+		_mm_store_ps(out[i].s, x);
+	}
+#elif defined(MAT_NEON)
+	float32x4_t c0 = vld1q_f32(&m.s[0]);
+	float32x4_t c1 = vld1q_f32(&m.s[4]);
+	float32x4_t c2 = vld1q_f32(&m.s[8]);
+	float32x4_t c3 = vld1q_f32(&m.s[12]);
+	for (int i = 0; i < n; i++) {
+		const float* v = in[i].s;
+		float32x4_t x = vmulq_n_f32(c0, v[0]);
+		x = vaddq_f32(x, vmulq_n_f32(c1, v[1]));
+		x = vaddq_f32(x, vmulq_n_f32(c2, v[2]));
+		x = vaddq_f32(x, vmulq_n_f32(c3, v[3]));
+		vst1q_f32(out[i].s, x);
+	}
+#else
+	for (int i = 0; i < n; i++) out[i] = mat44_transform_scalar(m, in[i]);
+#endif
+}
+
+// out[i] = m * (in[i], 1); in and out may be the same array
+inline static void mat44_transform_point_batch(struct mat44 m, int n, const union vec3* in, union vec3* out)
+{
+#if defined(MAT_SSE)
+	__m128 c0 = _mm_loadu_ps(&m.s[0]);
+	__m128 c1 = _mm_loadu_ps(&m.s[4]);
+	__m128 c2 = _mm_loadu_ps(&m.s[8]);
+	__m128 c3 = _mm_loadu_ps(&m.s[12]);
+	for (int i = 0; i < n; i++) {
+		const float* v = in[i].s;
+		__m128 x = _mm_mul_ps(c0, _mm_set1_ps(v[0]));
+		x = _mm_add_ps(x, _mm_mul_ps(c1, _mm_set1_ps(v[1])));
+		x = _mm_add_ps(x, _mm_mul_ps(c2, _mm_set1_ps(v[2])));
+		x = _mm_add_ps(x, c3);
+		// vec3 is 12 bytes; a 16 byte store would clobber the next element
+		_mm_storel_pi((__m64*)out[i].s, x);
+		_mm_store_ss(&out[i].s[2], _mm_movehl_ps(x, x));
+	}
+#else
+	for (int i = 0; i < n; i++) out[i] = mat44_transform_point(m, in[i]);
+#endif
+}
+
 inline static struct mat44 mat44_zero()
 {
 	struct mat44 m;
@@ -1,19 +1,36 @@
 #version 120
+#extension GL_ARB_uniform_buffer_object : require
 
 attribute vec3 a_position;
-attribute vec3 a_normal;
+attribute float a_normal; // shader_pack_oct16() in shader.h
 attribute vec2 a_uv;
 
-uniform mat4 u_projection;
-uniform mat4 u_view;
+// render_view_block in render.c; written once per frame
+layout(std140) uniform render_view {
+	mat4 u_view;
+	mat4 u_projection;
+};
+
+// a_position is chunk-relative and normalized to [-1;1]
+uniform vec3 u_chunk_center;
+uniform vec3 u_chunk_extent;
 
 varying vec3 v_normal;
 varying vec2 v_uv;
 
+vec3 oct16_decode(float packed)
+{
+	float c = packed + 32768.0;
+	float hi = floor(c / 256.0);
+	vec2 e = vec2(hi, c - hi * 256.0) / 127.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * (step(0.0, n.xy) * 2.0 - 1.0);
+	return normalize(n);
+}
+
 void main()
 {
-	v_normal = a_normal;
+	v_normal = oct16_decode(a_normal);
 	v_uv = a_uv;
-	gl_Position = u_projection * u_view * vec4(a_position, 1);
+	gl_Position = u_projection * u_view * vec4(u_chunk_center + a_position * u_chunk_extent, 1);
 }
-
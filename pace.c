@@ -0,0 +1,56 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <time.h>
+
+#include "pace.h"
+#include "prof.h"
+
+void pace_init(struct pace* pace, double refresh_hz)
+{
+	memset(pace, 0, sizeof(*pace));
+	pace->enabled = refresh_hz > 0;
+	pace->refresh_ms = pace->enabled ? 1000.0 / refresh_hz : 0;
+}
+
+void pace_wait(struct pace* pace)
+{
+	if (pace->enabled && pace->swap_ns > 0 && pace->delay_ms > 0) {
+		prof_begin("pace_wait");
+		uint64_t until_ns = pace->swap_ns + (uint64_t)(pace->delay_ms * 1e6);
+		uint64_t now_ns = prof_ns();
+		if (until_ns > now_ns) {
+			struct timespec ts;
+			uint64_t dt = until_ns - now_ns;
+			ts.tv_sec = dt / 1000000000ULL;
+			ts.tv_nsec = dt % 1000000000ULL;
+			nanosleep(&ts, NULL);
+		}
+		prof_end();
+	}
+	pace->work_begin_ns = prof_ns();
+}
+
+void pace_work_end(struct pace* pace)
+{
+	if (!pace->enabled) return;
+
+	double work_ms = (double)(prof_ns() - pace->work_begin_ns) * 1e-6;
+	pace->work_ms[pace->cursor] = work_ms;
+	pace->cursor = (pace->cursor + 1) % PACE_HISTORY;
+	if (pace->n_work < PACE_HISTORY) pace->n_work++;
+
+	double predicted_ms = 0;
+	for (int i = 0; i < pace->n_work; i++) {
+		if (pace->work_ms[i] > predicted_ms) predicted_ms = pace->work_ms[i];
+	}
+
+	double delay_ms = pace->refresh_ms - predicted_ms - PACE_MARGIN_MS;
+	if (delay_ms < 0) delay_ms = 0;
+	pace->delay_ms = delay_ms;
+}
+
+void pace_swapped(struct pace* pace)
+{
+	pace->swap_ns = prof_ns();
+}
@@ -0,0 +1,40 @@
+#ifndef PACE_H
+
+#include <stdint.h>
+
+/*
+adaptive frame delay. with vsync, a frame that starts right after the swap
+returns and finishes early just sits on its input until the next vsync.
+instead, pace_wait() sleeps after the swap for as long as the recent frame
+work times allow, so that input is sampled as late as possible while work
+still completes PACE_MARGIN_MS before vsync. the prediction is the slowest
+of the last PACE_HISTORY frames; a missed vsync costs a whole refresh, so
+it errs on the early side.
+
+per frame: pace_wait() before sampling input, pace_work_end() right before
+the swap, pace_swapped() right after it.
+*/
+
+#define PACE_HISTORY (30)
+#define PACE_MARGIN_MS (2.0)
+
+struct pace {
+	int enabled;
+	double refresh_ms;
+
+	double work_ms[PACE_HISTORY];
+	int n_work;
+	int cursor;
+
+	double delay_ms; // current sleep after swap
+	uint64_t swap_ns; // when the last swap returned
+	uint64_t work_begin_ns;
+};
+
+void pace_init(struct pace* pace, double refresh_hz); // refresh_hz <= 0 disables pacing
+void pace_wait(struct pace* pace);
+void pace_work_end(struct pace* pace);
+void pace_swapped(struct pace* pace);
+
+#define PACE_H
+#endif
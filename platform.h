@@ -3,14 +3,32 @@
 #if BUILD_LINUX
 #include <epoxy/gl.h>
 #include <epoxy/glx.h>
+#define platform_gl_version() epoxy_gl_version()
+#define platform_has_gl_extension(name) epoxy_has_gl_extension(name)
 #elif BUILD_MINGW32
 #include <GL/glew.h>
+#define platform_gl_version() (GLEW_VERSION_4_1 ? 41 : GLEW_VERSION_3_3 ? 33 : GLEW_VERSION_3_0 ? 30 : 21)
+#define platform_has_gl_extension(name) glewIsSupported(name)
 #elif BUILD_OSX
 #include <gl.h>
 #endif
 
 #ifndef BUILD_MINGW32
 #include <alloca.h>
+#include <sys/stat.h>
+#define platform_mkdir(path) mkdir(path, 0755)
+#else
+#include <direct.h>
+#define platform_mkdir(path) _mkdir(path)
+#endif
+
+// sub-second part of a struct stat's mtime; 0 where there's none
+#if BUILD_LINUX
+#define platform_stat_mtime_nsec(st) ((st)->st_mtim.tv_nsec)
+#elif BUILD_OSX
+#define platform_stat_mtime_nsec(st) ((st)->st_mtimespec.tv_nsec)
+#else
+#define platform_stat_mtime_nsec(st) (0)
 #endif
 
 #define PLATFORM_H
@@ -0,0 +1,289 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <time.h>
+
+#include "platform.h"
+#include "prof.h"
+#include "a.h"
+
+struct prof_gpu_sample {
+	int zone_index;
+	GLuint queries[2]; // begin, end
+};
+
+struct prof_frame {
+	int64_t frame_number; // -1 if slot is unused
+	uint64_t cpu_ns[PROF_MAX_ZONES];
+	int calls[PROF_MAX_ZONES];
+	int n_gpu_samples;
+	struct prof_gpu_sample gpu_samples[PROF_MAX_GPU_SAMPLES_PER_FRAME];
+};
+
+struct prof_stack_entry {
+	int zone_index;
+	uint64_t begin_ns;
+	int gpu_sample_index; // -1 if none
+};
+
+static struct {
+	int initialized;
+	int enable_gpu;
+
+	int n_zones;
+	struct prof_zone zones[PROF_MAX_ZONES];
+
+	int depth;
+	struct prof_stack_entry stack[PROF_MAX_DEPTH];
+
+	int64_t frame_number;
+	int64_t gpu_frame_number;
+	int frame_slot;
+	struct prof_frame frames[PROF_GPU_LATENCY];
+
+	FILE* csv;
+} prof;
+
+uint64_t prof_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void prof_init(int enable_gpu)
+{
+	memset(&prof, 0, sizeof(prof));
+	prof.initialized = 1;
+	prof.gpu_frame_number = -1;
+
+	if (enable_gpu && (platform_gl_version() >= 33 || platform_has_gl_extension("GL_ARB_timer_query"))) {
+		prof.enable_gpu = 1;
+	}
+
+	for (int i = 0; i < PROF_GPU_LATENCY; i++) {
+		struct prof_frame* frame = &prof.frames[i];
+		frame->frame_number = -1;
+		if (!prof.enable_gpu) continue;
+		for (int j = 0; j < PROF_MAX_GPU_SAMPLES_PER_FRAME; j++) {
+			glGenQueries(2, frame->gpu_samples[j].queries); CHKGL;
+		}
+	}
+}
+
+int prof_has_gpu()
+{
+	return prof.enable_gpu;
+}
+
+void prof_free()
+{
+	if (!prof.initialized) return;
+
+	if (prof.enable_gpu) {
+		for (int i = 0; i < PROF_GPU_LATENCY; i++) {
+			for (int j = 0; j < PROF_MAX_GPU_SAMPLES_PER_FRAME; j++) {
+				glDeleteQueries(2, prof.frames[i].gpu_samples[j].queries);
+			}
+		}
+	}
+
+	if (prof.csv) fclose(prof.csv);
+
+	memset(&prof, 0, sizeof(prof));
+}
+
+static int prof_get_zone_index(const char* name, int parent)
+{
+	for (int i = 0; i < prof.n_zones; i++) {
+		struct prof_zone* zone = &prof.zones[i];
+		if (zone->parent == parent && (zone->name == name || strcmp(zone->name, name) == 0)) return i;
+	}
+
+	if (prof.n_zones >= PROF_MAX_ZONES) arghf("too many profiler zones (%d)", PROF_MAX_ZONES);
+
+	int zone_index = prof.n_zones++;
+	struct prof_zone* zone = &prof.zones[zone_index];
+	memset(zone, 0, sizeof(*zone));
+	zone->name = name;
+	zone->parent = parent;
+	zone->depth = parent < 0 ? 0 : prof.zones[parent].depth + 1;
+	return zone_index;
+}
+
+static struct prof_frame* prof_current_frame()
+{
+	return &prof.frames[prof.frame_slot];
+}
+
+void prof_begin(const char* name)
+{
+	if (!prof.initialized) return;
+	ASSERT(prof.depth < PROF_MAX_DEPTH);
+
+	int parent = prof.depth > 0 ? prof.stack[prof.depth-1].zone_index : -1;
+	struct prof_stack_entry* e = &prof.stack[prof.depth++];
+	e->zone_index = prof_get_zone_index(name, parent);
+	e->gpu_sample_index = -1;
+
+	struct prof_frame* frame = prof_current_frame();
+	if (prof.enable_gpu && frame->n_gpu_samples < PROF_MAX_GPU_SAMPLES_PER_FRAME) {
+		e->gpu_sample_index = frame->n_gpu_samples++;
+		struct prof_gpu_sample* sample = &frame->gpu_samples[e->gpu_sample_index];
+		sample->zone_index = e->zone_index;
+		glQueryCounter(sample->queries[0], GL_TIMESTAMP); CHKGL;
+	}
+
+	e->begin_ns = prof_ns();
+}
+
+void prof_end()
+{
+	if (!prof.initialized) return;
+	uint64_t end_ns = prof_ns();
+
+	ASSERT(prof.depth > 0);
+	struct prof_stack_entry* e = &prof.stack[--prof.depth];
+	struct prof_frame* frame = prof_current_frame();
+	frame->cpu_ns[e->zone_index] += end_ns - e->begin_ns;
+	frame->calls[e->zone_index]++;
+
+	if (e->gpu_sample_index >= 0) {
+		glQueryCounter(frame->gpu_samples[e->gpu_sample_index].queries[1], GL_TIMESTAMP); CHKGL;
+	}
+}
+
+void prof_sample(const char* name, uint64_t ns)
+{
+	if (!prof.initialized) return;
+	ASSERT(prof.depth > 0);
+	int zone_index = prof_get_zone_index(name, prof.stack[prof.depth-1].zone_index);
+	struct prof_frame* frame = prof_current_frame();
+	frame->cpu_ns[zone_index] += ns;
+	frame->calls[zone_index]++;
+}
+
+void prof_frame_begin()
+{
+	if (!prof.initialized) return;
+	ASSERT(prof.depth == 0);
+
+	struct prof_frame* frame = prof_current_frame();
+	memset(frame->cpu_ns, 0, sizeof(frame->cpu_ns));
+	memset(frame->calls, 0, sizeof(frame->calls));
+	frame->n_gpu_samples = 0;
+	frame->frame_number = prof.frame_number;
+
+	prof_begin("frame");
+}
+
+static double smooth(double avg, double x)
+{
+	return avg == 0 ? x : avg * 0.95 + x * 0.05;
+}
+
+// reads back GPU results of a frame recorded PROF_GPU_LATENCY-1 frames ago
+static void prof_resolve(struct prof_frame* frame)
+{
+	if (frame->frame_number < 0) return;
+
+	uint64_t gpu_ns[PROF_MAX_ZONES];
+	memset(gpu_ns, 0, sizeof(gpu_ns));
+	for (int i = 0; i < frame->n_gpu_samples; i++) {
+		struct prof_gpu_sample* sample = &frame->gpu_samples[i];
+		GLuint64 t0, t1;
+		glGetQueryObjectui64v(sample->queries[0], GL_QUERY_RESULT, &t0); CHKGL;
+		glGetQueryObjectui64v(sample->queries[1], GL_QUERY_RESULT, &t1); CHKGL;
+		if (t1 > t0) gpu_ns[sample->zone_index] += t1 - t0;
+	}
+
+	for (int i = 0; i < prof.n_zones; i++) {
+		struct prof_zone* zone = &prof.zones[i];
+		zone->gpu_ms = (double)gpu_ns[i] * 1e-6;
+		zone->gpu_ms_avg = smooth(zone->gpu_ms_avg, zone->gpu_ms);
+	}
+	prof.gpu_frame_number = frame->frame_number;
+
+	if (prof.csv) {
+		for (int i = 0; i < prof.n_zones; i++) {
+			if (frame->calls[i] == 0) continue;
+			struct prof_zone* zone = &prof.zones[i];
+			fprintf(prof.csv, "%lld,%s,%s,%d,%d,%.6f,%.6f\n",
+				(long long)frame->frame_number,
+				zone->name,
+				zone->parent >= 0 ? prof.zones[zone->parent].name : "",
+				zone->depth,
+				frame->calls[i],
+				(double)frame->cpu_ns[i] * 1e-6,
+				prof.enable_gpu ? (double)gpu_ns[i] * 1e-6 : 0.0);
+		}
+	}
+
+	frame->frame_number = -1;
+}
+
+void prof_frame_end()
+{
+	if (!prof.initialized) return;
+
+	prof_end(); // "frame"
+	ASSERT(prof.depth == 0);
+
+	struct prof_frame* frame = prof_current_frame();
+	for (int i = 0; i < prof.n_zones; i++) {
+		struct prof_zone* zone = &prof.zones[i];
+		zone->cpu_ms = (double)frame->cpu_ns[i] * 1e-6;
+		zone->calls = frame->calls[i];
+		zone->cpu_ms_avg = smooth(zone->cpu_ms_avg, zone->cpu_ms);
+	}
+
+	prof.frame_number++;
+	prof.frame_slot = (prof.frame_slot + 1) % PROF_GPU_LATENCY;
+	prof_resolve(prof_current_frame());
+}
+
+int64_t prof_gpu_frame_number()
+{
+	return prof.gpu_frame_number;
+}
+
+int prof_n_zones()
+{
+	return prof.n_zones;
+}
+
+struct prof_zone* prof_get_zone(int zone_index)
+{
+	ASSERT(zone_index >= 0 && zone_index < prof.n_zones);
+	return &prof.zones[zone_index];
+}
+
+int prof_find_zone(const char* name)
+{
+	for (int i = 0; i < prof.n_zones; i++) {
+		if (strcmp(prof.zones[i].name, name) == 0) return i;
+	}
+	return -1;
+}
+
+void prof_dump(FILE* f)
+{
+	fprintf(f, "%-32s %10s %10s %6s\n", "zone", "cpu ms", "gpu ms", "calls");
+	for (int i = 0; i < prof.n_zones; i++) {
+		struct prof_zone* zone = &prof.zones[i];
+		fprintf(f, "%*s%-*s %10.3f %10.3f %6d\n",
+			zone->depth * 2, "",
+			32 - zone->depth * 2, zone->name,
+			zone->cpu_ms_avg,
+			zone->gpu_ms_avg,
+			zone->calls);
+	}
+}
+
+void prof_csv_open(const char* path)
+{
+	if (prof.csv) fclose(prof.csv);
+	prof.csv = fopen(path, "w");
+	if (prof.csv == NULL) arghf("%s: could not open for writing", path);
+	fprintf(prof.csv, "frame,zone,parent,depth,calls,cpu_ms,gpu_ms\n");
+}
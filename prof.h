@@ -0,0 +1,67 @@
+#ifndef PROF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+frame profiler with nestable named zones. every zone is timed on the CPU
+with a monotonic clock, and (if enabled) on the GPU with GL_TIMESTAMP
+queries. GPU results are read back PROF_GPU_LATENCY frames late so that
+reading them never stalls the pipeline.
+
+zones are identified by name and parent, so the same name may appear under
+several parents. names must outlive the profiler (use string literals). a
+zone entered several times per frame accumulates. all zones implicitly nest
+under the "frame" zone opened by prof_frame_begin().
+
+main thread only.
+*/
+
+#define PROF_MAX_ZONES (64)
+#define PROF_MAX_DEPTH (16)
+#define PROF_MAX_GPU_SAMPLES_PER_FRAME (256)
+#define PROF_GPU_LATENCY (4)
+
+struct prof_zone {
+	const char* name;
+	int parent; // -1 for the root ("frame") zone
+	int depth;
+
+	// latest complete frame, in milliseconds
+	double cpu_ms;
+	double gpu_ms;
+	int calls;
+
+	// smoothed, for display
+	double cpu_ms_avg;
+	double gpu_ms_avg;
+};
+
+void prof_init(int enable_gpu);
+int prof_has_gpu(); // 0 if GPU timing was disabled or isn't supported
+void prof_free();
+
+void prof_frame_begin();
+void prof_frame_end();
+
+void prof_begin(const char* name);
+void prof_end();
+
+// adds a duration measured by other means (e.g. a latency spanning frames)
+// to a zone under the current one, as CPU time
+void prof_sample(const char* name, uint64_t ns);
+
+// number of the frame whose GPU times are currently in the zones; -1 if none
+int64_t prof_gpu_frame_number();
+
+int prof_n_zones();
+struct prof_zone* prof_get_zone(int zone_index);
+int prof_find_zone(const char* name); // first zone with this name, -1 if none
+
+void prof_dump(FILE* f); // human readable table of smoothed zone times
+void prof_csv_open(const char* path); // per-frame CSV rows until prof_free()
+
+uint64_t prof_ns(); // monotonic clock in nanoseconds
+
+#define PROF_H
+#endif
@@ -0,0 +1,29 @@
+#version 120
+#extension GL_ARB_uniform_buffer_object : require
+
+attribute vec3 a_position;
+attribute vec3 a_normal;
+attribute vec2 a_uv;
+
+// per instance; columns of the instance transform
+attribute vec4 a_tx0;
+attribute vec4 a_tx1;
+attribute vec4 a_tx2;
+attribute vec4 a_tx3;
+
+// render_view_block in render.c; written once per frame
+layout(std140) uniform render_view {
+	mat4 u_view;
+	mat4 u_projection;
+};
+
+varying vec3 v_normal;
+varying vec2 v_uv;
+
+void main()
+{
+	mat4 tx = mat4(a_tx0, a_tx1, a_tx2, a_tx3);
+	v_normal = normalize(mat3(tx) * a_normal);
+	v_uv = a_uv;
+	gl_Position = u_projection * u_view * tx * vec4(a_position, 1);
+}
@@ -1,32 +1,425 @@
+#include <stdlib.h>
 #include <string.h>
 
 #include "platform.h"
 #include "render.h"
+#include "prof.h"
+#include "trace.h"
+#include "counters.h"
+#include "frame.h"
 
-void render_init(struct render* render, SDL_Window* window)
-{
-	AN(render);
-	AN(window);
+// 12 bytes, down from 32 (8 floats)
+struct render_vertex {
+	int16_t position[3]; // SHADER_ATTR_SHORT3N, chunk-relative
+	int16_t normal; // SHADER_ATTR_SHORT, shader_pack_oct16()
+	uint16_t uv[2]; // SHADER_ATTR_HALF2
+};
 
-	memset(render, 0, sizeof(*render));
-	render->window = window;
+struct render_prop_vertex {
+	float position[3]; // SHADER_ATTR_VEC3, mesh space
+	uint32_t normal; // SHADER_ATTR_INT_2_10_10_10_REV
+	uint16_t uv[2]; // SHADER_ATTR_HALF2
+};
+
+// the render_view uniform block of nullmat.vert.glsl and prop.vert.glsl;
+// std140, which lays out mat4s as 16 packed floats
+#define RENDER_VIEW_BINDING (0)
+struct render_view_block {
+	struct mat44 view;
+	struct mat44 projection;
+};
+
+/*
+the shaders are #version 120, but vertex arrays, the packed attribute
+formats (shader.c), instanced props, offscreen framebuffers and the view
+uniform buffer need GL 3.3 or these extensions. checked up front so that
+a missing feature is an error message instead of a CHKGL abort somewhere
+in render_init()
+*/
+static const char* render_required_gl_extensions[] = {
+	"GL_ARB_vertex_array_object",
+	"GL_ARB_half_float_vertex",
+	"GL_ARB_vertex_type_2_10_10_10_rev",
+	"GL_ARB_instanced_arrays",
+	"GL_ARB_draw_instanced",
+	"GL_ARB_framebuffer_object",
+	"GL_ARB_uniform_buffer_object",
+	NULL
+};
 
+static void render_check_gl_features()
+{
+	int version = platform_gl_version();
+	if (version >= 33) return;
+	for (const char** ext = render_required_gl_extensions; *ext != NULL; ext++) {
+		if (!platform_has_gl_extension(*ext)) {
+			arghf("OpenGL 3.3 or %s is required; have %d.%d (%s)", *ext, version / 10, version % 10, (const char*)glGetString(GL_RENDERER));
+		}
+	}
+}
+
+static void render_init_common(struct render* render)
+{
 	vtxbuf_init(&render->vtxbuf, 1<<18);
 
 	{
 		#include "nullmat.glsl.inc"
 		struct shader_attr_spec specs[] = {
-			{"a_position", SHADER_ATTR_VEC3},
-			{"a_normal", SHADER_ATTR_VEC3},
-			{"a_uv", SHADER_ATTR_VEC2},
+			{"a_position", SHADER_ATTR_SHORT3N},
+			{"a_normal", SHADER_ATTR_SHORT},
+			{"a_uv", SHADER_ATTR_HALF2},
 			{NULL}
 		};
-		shader_init(
+		shader_start(
 			&render->nullmat_shader,
 			nullmat_vert_src,
 			nullmat_frag_src,
 			specs);
 	}
+
+	{
+		#include "flat.glsl.inc"
+		struct shader_attr_spec specs[] = {
+			{"a_position", SHADER_ATTR_VEC2},
+			{"a_color", SHADER_ATTR_VEC4},
+			{NULL}
+		};
+		shader_start(
+			&render->flat_shader,
+			flat_vert_src,
+			flat_frag_src,
+			specs);
+	}
+
+	{
+		#include "prop.glsl.inc"
+		struct shader_attr_spec specs[] = {
+			{"a_position", SHADER_ATTR_VEC3},
+			{"a_normal", SHADER_ATTR_INT_2_10_10_10_REV},
+			{"a_uv", SHADER_ATTR_HALF2},
+			{"a_tx0", SHADER_ATTR_VEC4, 1},
+			{"a_tx1", SHADER_ATTR_VEC4, 1},
+			{"a_tx2", SHADER_ATTR_VEC4, 1},
+			{"a_tx3", SHADER_ATTR_VEC4, 1},
+			{NULL}
+		};
+		shader_start(
+			&render->prop_shader,
+			prop_vert_src,
+			prop_frag_src,
+			specs);
+	}
+
+	shader_finish(&render->nullmat_shader);
+	shader_finish(&render->flat_shader);
+	shader_finish(&render->prop_shader);
+
+	ASSERT(render->nullmat_shader.stride == sizeof(struct render_vertex));
+	ASSERT(render->flat_shader.stride == 6*sizeof(float)); // see render_flat_quad()
+	ASSERT(render->prop_shader.stride == sizeof(struct render_prop_vertex));
+	ASSERT(render->prop_shader.instance_stride == sizeof(struct mat44));
+
+	glGenBuffers(1, &render->view_ubo); CHKGL;
+	glBindBuffer(GL_UNIFORM_BUFFER, render->view_ubo); CHKGL;
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(struct render_view_block), NULL, GL_DYNAMIC_DRAW); CHKGL;
+	glBindBuffer(GL_UNIFORM_BUFFER, 0); CHKGL;
+	glBindBufferBase(GL_UNIFORM_BUFFER, RENDER_VIEW_BINDING, render->view_ubo); CHKGL;
+	// program state, so set after every link or program binary load
+	shader_uniform_block_binding(&render->nullmat_shader, "render_view", RENDER_VIEW_BINDING);
+	shader_uniform_block_binding(&render->prop_shader, "render_view", RENDER_VIEW_BINDING);
+}
+
+// view is the late-latched one (see main.c); this is its one upload per frame
+static void render_set_view(struct render* render, struct mat44 view, struct mat44 projection)
+{
+	struct render_view_block block;
+	block.view = view;
+	block.projection = projection;
+	glBindBuffer(GL_UNIFORM_BUFFER, render->view_ubo); CHKGL;
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block); CHKGL;
+	glBindBuffer(GL_UNIFORM_BUFFER, 0); CHKGL;
+}
+
+void render_init(struct render* render, SDL_Window* window)
+{
+	AN(render);
+	AN(window);
+
+	render_check_gl_features();
+
+	memset(render, 0, sizeof(*render));
+	render->window = window;
+
+	render_init_common(render);
+}
+
+void render_init_offscreen(struct render* render, int width, int height)
+{
+	AN(render);
+	ASSERT(width > 0 && height > 0);
+
+	render_check_gl_features();
+
+	memset(render, 0, sizeof(*render));
+	render->width = width;
+	render->height = height;
+
+	glGenFramebuffers(1, &render->fbo); CHKGL;
+	glBindFramebuffer(GL_FRAMEBUFFER, render->fbo); CHKGL;
+	glGenRenderbuffers(2, render->fbo_renderbuffers); CHKGL;
+
+	glBindRenderbuffer(GL_RENDERBUFFER, render->fbo_renderbuffers[0]); CHKGL;
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height); CHKGL;
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, render->fbo_renderbuffers[0]); CHKGL;
+
+	glBindRenderbuffer(GL_RENDERBUFFER, render->fbo_renderbuffers[1]); CHKGL;
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height); CHKGL;
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, render->fbo_renderbuffers[1]); CHKGL;
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE) arghf("incomplete framebuffer (%d)", status);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, 0); CHKGL;
+
+	render_init_common(render);
+}
+
+void render_get_size(struct render* render, int* width, int* height)
+{
+	if (render->window) {
+		SDL_GetWindowSize(render->window, width, height);
+	} else {
+		*width = render->width;
+		*height = render->height;
+	}
+}
+
+void render_read_pixels(struct render* render, uint8_t* rgba)
+{
+	int width, height;
+	render_get_size(render, &width, &height);
+	glBindFramebuffer(GL_FRAMEBUFFER, render->fbo); CHKGL;
+	glPixelStorei(GL_PACK_ALIGNMENT, 1); CHKGL;
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba); CHKGL;
+}
+
+static struct render_vertex render_pack_vertex(struct lvl_vertex* lv, struct aabb* chunk_aabb, int16_t packed_normal)
+{
+	struct render_vertex rv;
+	for (int i = 0; i < 3; i++) {
+		float extent = chunk_aabb->extent.s[i];
+		float rel = extent > 0 ? (lv->co.s[i] - chunk_aabb->center.s[i]) / extent : 0;
+		rv.position[i] = shader_pack_snorm16(rel);
+	}
+	rv.normal = packed_normal;
+	for (int i = 0; i < 2; i++) rv.uv[i] = shader_pack_half(lv->uv.s[i]);
+	return rv;
+}
+
+// nullmat and prop shading have always used the back facing normal
+static union vec3 polygon_shading_normal(struct lvl_polygon* polygon)
+{
+	return vec3_scale(polygon->normal, -1);
+}
+
+/*
+chunk geometry; like the meshes below, all chunks go in one vertex buffer
+and one index buffer, and each polygon is a triangle fan of indices into
+its chunk's vertices in polygon list order. that way the GPU sees the
+vertex sharing and ordering compile.lua/locality.lua produce. a vertex gets
+the normal of the (last) polygon using it; locality.lua only welds vertices
+of polygons with equal normals
+*/
+static void render_set_lvl_chunks(struct render* render, struct lvl* lvl)
+{
+	int n_vertices = 0;
+	int n_indices = 0;
+	for (int i = 0; i < lvl->n_chunks; i++) {
+		struct lvl_chunk* chunk = lvl_get_chunk(lvl, i);
+		n_vertices += chunk->n_vertices;
+		for (int j = 0; j < chunk->n_polygons; j++) n_indices += (chunk->polygons[j].n_vertices - 2) * 3;
+	}
+
+	struct render_vertex* vertices = calloc(n_vertices + 1, sizeof(*vertices));
+	uint32_t* indices = calloc(n_indices + 1, sizeof(*indices));
+	AN(vertices);
+	AN(indices);
+	AN(render->chunk_index_offsets = calloc(lvl->n_chunks + 1, sizeof(int)));
+	AN(render->chunk_index_counts = calloc(lvl->n_chunks + 1, sizeof(int)));
+
+	int vertex_offset = 0;
+	int index_offset = 0;
+	for (int i = 0; i < lvl->n_chunks; i++) {
+		struct lvl_chunk* chunk = lvl_get_chunk(lvl, i);
+		render->chunk_index_offsets[i] = index_offset;
+
+		for (int p = 0; p < chunk->n_polygons; p++) {
+			struct lvl_polygon* polygon = &chunk->polygons[p];
+			int vertex_count = polygon->n_vertices;
+			uint32_t* pindices = &chunk->polygon_list[polygon->offset];
+			int16_t packed_normal = shader_pack_oct16(polygon_shading_normal(polygon));
+			for (int j = 0; j < vertex_count; j++) {
+				vertices[vertex_offset + pindices[j]] = render_pack_vertex(&chunk->vertices[pindices[j]], &chunk->aabb, packed_normal);
+			}
+			for (int j = 0; j < (vertex_count - 2); j++) {
+				indices[index_offset++] = vertex_offset + pindices[0];
+				indices[index_offset++] = vertex_offset + pindices[j+1];
+				indices[index_offset++] = vertex_offset + pindices[j+2];
+			}
+		}
+
+		render->chunk_index_counts[i] = index_offset - render->chunk_index_offsets[i];
+		vertex_offset += chunk->n_vertices;
+	}
+
+	glGenBuffers(2, render->chunk_buffers); CHKGL;
+	glGenVertexArrays(1, &render->chunk_vao); CHKGL;
+	glBindVertexArray(render->chunk_vao); CHKGL;
+
+	glBindBuffer(GL_ARRAY_BUFFER, render->chunk_buffers[0]); CHKGL;
+	glBufferData(GL_ARRAY_BUFFER, n_vertices * sizeof(*vertices), vertices, GL_STATIC_DRAW); CHKGL;
+	shader_enable_arrays(&render->nullmat_shader);
+	shader_set_attrib_pointers(&render->nullmat_shader);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, render->chunk_buffers[1]); CHKGL;
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, n_indices * sizeof(*indices), indices, GL_STATIC_DRAW); CHKGL;
+
+	glBindVertexArray(0); CHKGL;
+
+	free(vertices);
+	free(indices);
+}
+
+void render_set_lvl(struct render* render, struct lvl* lvl)
+{
+	AN(render);
+
+	if (render->lvl) {
+		glDeleteVertexArrays(1, &render->chunk_vao); CHKGL;
+		glDeleteBuffers(2, render->chunk_buffers); CHKGL;
+		free(render->chunk_index_offsets);
+		free(render->chunk_index_counts);
+		render->chunk_index_offsets = render->chunk_index_counts = NULL;
+		glDeleteVertexArrays(1, &render->prop_vao); CHKGL;
+		glDeleteBuffers(3, render->prop_buffers); CHKGL;
+		free(render->mesh_index_offsets);
+		free(render->mesh_index_counts);
+		free(render->chunk_instance_offsets);
+		render->mesh_index_offsets = render->mesh_index_counts = render->chunk_instance_offsets = NULL;
+		render->lvl = NULL;
+	}
+
+	if (lvl == NULL) return;
+	render->lvl = lvl;
+
+	render_set_lvl_chunks(render, lvl);
+
+	// meshes; all in one vertex buffer and one index buffer, with indices
+	// pointing directly into the vertex buffer
+	int n_vertices = 0;
+	int n_indices = 0;
+	for (int i = 0; i < lvl->n_meshes; i++) {
+		struct lvl_mesh* mesh = lvl_get_mesh(lvl, i);
+		n_vertices += mesh->n_vertices;
+		for (int j = 0; j < mesh->n_polygons; j++) n_indices += (mesh->polygons[j].n_vertices - 2) * 3;
+	}
+
+	struct render_prop_vertex* vertices = calloc(n_vertices + 1, sizeof(*vertices));
+	uint32_t* indices = calloc(n_indices + 1, sizeof(*indices));
+	AN(vertices);
+	AN(indices);
+	AN(render->mesh_index_offsets = calloc(lvl->n_meshes + 1, sizeof(int)));
+	AN(render->mesh_index_counts = calloc(lvl->n_meshes + 1, sizeof(int)));
+
+	int vertex_offset = 0;
+	int index_offset = 0;
+	for (int i = 0; i < lvl->n_meshes; i++) {
+		struct lvl_mesh* mesh = lvl_get_mesh(lvl, i);
+		render->mesh_index_offsets[i] = index_offset;
+
+		for (int j = 0; j < mesh->n_vertices; j++) {
+			struct render_prop_vertex* v = &vertices[vertex_offset + j];
+			for (int k = 0; k < 3; k++) v->position[k] = mesh->vertices[j].co.s[k];
+			for (int k = 0; k < 2; k++) v->uv[k] = shader_pack_half(mesh->vertices[j].uv.s[k]);
+		}
+
+		for (int p = 0; p < mesh->n_polygons; p++) {
+			struct lvl_polygon* polygon = &mesh->polygons[p];
+			int vertex_count = polygon->n_vertices;
+			uint32_t* pindices = &mesh->polygon_list[polygon->offset];
+			uint32_t packed_normal = shader_pack_int_2_10_10_10_rev(polygon_shading_normal(polygon));
+			for (int j = 0; j < vertex_count; j++) vertices[vertex_offset + pindices[j]].normal = packed_normal;
+			for (int j = 0; j < (vertex_count - 2); j++) {
+				indices[index_offset++] = vertex_offset + pindices[0];
+				indices[index_offset++] = vertex_offset + pindices[j+1];
+				indices[index_offset++] = vertex_offset + pindices[j+2];
+			}
+		}
+
+		render->mesh_index_counts[i] = index_offset - render->mesh_index_offsets[i];
+		vertex_offset += mesh->n_vertices;
+	}
+
+	// instance transforms, chunk by chunk
+	int n_instances = 0;
+	AN(render->chunk_instance_offsets = calloc(lvl->n_chunks + 1, sizeof(int)));
+	for (int i = 0; i < lvl->n_chunks; i++) {
+		render->chunk_instance_offsets[i] = n_instances;
+		n_instances += lvl_get_chunk(lvl, i)->n_instances;
+	}
+	struct mat44* transforms = calloc(n_instances + 1, sizeof(*transforms));
+	AN(transforms);
+	for (int i = 0; i < lvl->n_chunks; i++) {
+		struct lvl_chunk* chunk = lvl_get_chunk(lvl, i);
+		for (int j = 0; j < chunk->n_instances; j++) {
+			transforms[render->chunk_instance_offsets[i] + j] = chunk->instances[j].transform;
+		}
+	}
+
+	glGenBuffers(3, render->prop_buffers); CHKGL;
+	glGenVertexArrays(1, &render->prop_vao); CHKGL;
+	glBindVertexArray(render->prop_vao); CHKGL;
+
+	glBindBuffer(GL_ARRAY_BUFFER, render->prop_buffers[0]); CHKGL;
+	glBufferData(GL_ARRAY_BUFFER, n_vertices * sizeof(*vertices), vertices, GL_STATIC_DRAW); CHKGL;
+	shader_enable_arrays(&render->prop_shader);
+	shader_set_attrib_pointers(&render->prop_shader);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, render->prop_buffers[1]); CHKGL;
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, n_indices * sizeof(*indices), indices, GL_STATIC_DRAW); CHKGL;
+
+	glBindBuffer(GL_ARRAY_BUFFER, render->prop_buffers[2]); CHKGL;
+	glBufferData(GL_ARRAY_BUFFER, n_instances * sizeof(*transforms), transforms, GL_STATIC_DRAW); CHKGL;
+
+	glBindVertexArray(0); CHKGL;
+
+	free(vertices);
+	free(indices);
+	free(transforms);
+}
+
+// one instanced draw per distinct mesh; instances are sorted by mesh
+static void render_chunk_props(struct render* render, struct lvl* lvl, uint32_t chunk_index)
+{
+	struct lvl_chunk* chunk = lvl_get_chunk(lvl, chunk_index);
+	int first_instance = render->chunk_instance_offsets[chunk_index];
+	int i = 0;
+	while (i < chunk->n_instances) {
+		uint32_t mesh_index = chunk->instances[i].mesh_index;
+		int n = 1;
+		while ((i + n) < chunk->n_instances && chunk->instances[i + n].mesh_index == mesh_index) n++;
+
+		shader_set_instance_attrib_pointers(&render->prop_shader, (first_instance + i) * sizeof(struct mat44));
+		glDrawElementsInstanced(
+			GL_TRIANGLES,
+			render->mesh_index_counts[mesh_index],
+			GL_UNSIGNED_INT,
+			(void*)(uintptr_t)(render->mesh_index_offsets[mesh_index] * sizeof(uint32_t)),
+			n); CHKGL;
+		COUNTER_ADD(COUNTER_DRAW_CALLS, 1);
+
+		i += n;
+	}
 }
 
 void render_lvl(struct render* render, struct lvl* lvl, struct lvl_entity* entity)
@@ -34,6 +427,12 @@ void render_lvl(struct render* render, struct lvl* lvl, struct lvl_entity* entit
 	AN(render);
 	AN(lvl);
 	AN(entity);
+	ASSERT(render->lvl == lvl);
+
+	prof_begin("render_lvl");
+	TRACE_BEGIN("render_lvl");
+
+	glBindFramebuffer(GL_FRAMEBUFFER, render->fbo); CHKGL;
 
 	if (entity->grounded) {
 		glClearColor(1,1,0,1);
@@ -47,7 +446,7 @@ void render_lvl(struct render* render, struct lvl* lvl, struct lvl_entity* entit
 
 	int window_width;
 	int window_height;
-	SDL_GetWindowSize(render->window, &window_width, &window_height);
+	render_get_size(render, &window_width, &window_height);
 
 	glViewport(0, 0, window_width, window_height); CHKGL;
 
@@ -56,54 +455,130 @@ void render_lvl(struct render* render, struct lvl* lvl, struct lvl_entity* entit
 	struct mat44 view = lvl_entity_view(entity);
 	struct mat44 projection = mat44_perspective(65, aspect, 0.1, 409.6);
 
-	vtxbuf_begin(&render->vtxbuf, &render->nullmat_shader, GL_TRIANGLES);
-	shader_uniform_mat44(&render->nullmat_shader, "u_view", view);
-	shader_uniform_mat44(&render->nullmat_shader, "u_projection", projection);
+	render_set_view(render, view, projection);
 
-	struct lvl_chunk* chunk = lvl_get_chunk(lvl, 0);
-	AN(chunk);
-	AN(chunk->polygon_list);
-	int cursor = 0;
+	shader_use(&render->nullmat_shader);
 
-	while (1) {
-		int vertex_count = chunk->polygon_list[cursor++];
-		if (vertex_count == 0) break;
+	// the entity's chunk plus every chunk the pvs can't rule out; whole
+	// chunks are rejected with one bit test each, and what's left is drawn
+	// whole (depth testing sorts it out; clipping against portals would
+	// only cut overdraw). the list lives in frame memory
+	uint32_t* visible = frame_alloc(lvl->n_chunks * sizeof(*visible));
+	int n_visible = 0;
+	visible[n_visible++] = entity->chunk_index;
+	for (int i = 0; i < lvl->n_chunks; i++) {
+		uint32_t chunk_index = i;
+		if (chunk_index != entity->chunk_index && lvl_chunk_maybe_visible(lvl, entity->chunk_index, chunk_index)) visible[n_visible++] = chunk_index;
+	}
 
-		uint32_t material_index = chunk->polygon_list[cursor++];
-		(void) material_index;
+	glBindVertexArray(render->chunk_vao); CHKGL;
+	for (int i = 0; i < n_visible; i++) {
+		struct lvl_chunk* chunk = lvl_get_chunk(lvl, visible[i]);
+		AN(chunk);
+		AN(chunk->polygon_list);
 
-		struct lvl_vertex vs[3];
-		vs[0] = chunk->vertices[chunk->polygon_list[cursor++]];
+		shader_uniform_vec3(&render->nullmat_shader, "u_chunk_center", chunk->aabb.center);
+		shader_uniform_vec3(&render->nullmat_shader, "u_chunk_extent", chunk->aabb.extent);
+		glDrawElements(
+			GL_TRIANGLES,
+			render->chunk_index_counts[visible[i]],
+			GL_UNSIGNED_INT,
+			(void*)(uintptr_t)(render->chunk_index_offsets[visible[i]] * sizeof(uint32_t))); CHKGL;
+		COUNTER_ADD(COUNTER_DRAW_CALLS, 1);
+	}
+	glBindVertexArray(0); CHKGL;
 
-		int tri_count = vertex_count - 2;
-		for (int i = 0; i < tri_count; i++) {
-			vs[1] = chunk->vertices[chunk->polygon_list[cursor++]];
-			vs[2] = chunk->vertices[chunk->polygon_list[cursor]];
+	// props are culled together with their chunk
+	shader_use(&render->prop_shader);
+	glBindVertexArray(render->prop_vao); CHKGL;
+	glBindBuffer(GL_ARRAY_BUFFER, render->prop_buffers[2]); CHKGL;
+	for (int i = 0; i < n_visible; i++) render_chunk_props(render, lvl, visible[i]);
+	glBindVertexArray(0); CHKGL;
 
-			// FIXME normal should not change, so don't calculate
-			// it more than once
-			union vec3 normal = vec3_normalize(vec3_cross(vec3_sub(vs[1].co, vs[0].co), vec3_sub(vs[1].co, vs[2].co)));
+	TRACE_END("render_lvl");
+	prof_end();
+}
 
-			float triangle[8*3];
-			int ti = 0;
-			for (int j = 0; j < 3; j++) {
-				for (int k = 0; k < 3; k++) triangle[ti++] = vs[j].co.s[k];
-				for (int k = 0; k < 3; k++) triangle[ti++] = normal.s[k];
-				for (int k = 0; k < 2; k++) triangle[ti++] = vs[j].uv.s[k];
-			}
-			vtxbuf_element(&render->vtxbuf, triangle, sizeof(triangle));
-		}
+static void render_flat_quad(struct render* render, float x0, float y0, float x1, float y1, union vec4 color)
+{
+	float xs[] = {x0, x1, x1, x0};
+	float ys[] = {y0, y0, y1, y1};
+	uint16_t* indices;
+	uint16_t base;
+	float* quad = vtxbuf_reserve_indexed(&render->vtxbuf, 4, 6, &indices, &base);
+	for (int i = 0; i < 4; i++) {
+		*(quad++) = xs[i];
+		*(quad++) = ys[i];
+		for (int j = 0; j < 4; j++) *(quad++) = color.s[j];
+	}
+	uint16_t quad_indices[] = {0, 1, 2, 0, 2, 3};
+	for (int i = 0; i < 6; i++) *(indices++) = base + quad_indices[i];
+	vtxbuf_commit_indexed(&render->vtxbuf, 4, 6);
+}
+
+void render_prof_overlay(struct render* render)
+{
+	AN(render);
+
+	// one row per zone, indented by depth; CPU time in the upper half of
+	// the row, GPU time in the lower half. full scale is 2 frames at 60Hz,
+	// and there's a tick at 1 frame
+	const float x_origin = -0.95f;
+	const float x_per_ms = 1.2f / 33.333f;
+	const float y_origin = 0.95f;
+	const float row_height = 0.04f;
+	const float indent = 0.02f;
+
+	union vec4 cpu_color = {{0.2f, 0.9f, 0.2f, 1}};
+	union vec4 gpu_color = {{0.9f, 0.3f, 0.2f, 1}};
+	union vec4 background_color = {{0, 0, 0, 1}};
+	union vec4 tick_color = {{1, 1, 1, 1}};
+
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
 
-		cursor++;
+	vtxbuf_begin_indexed(&render->vtxbuf, &render->flat_shader, GL_TRIANGLES);
+
+	int n_zones = prof_n_zones();
+	float y_end = y_origin - n_zones * row_height;
+	render_flat_quad(render, x_origin, y_end, x_origin + 33.333f * x_per_ms, y_origin, background_color);
+
+	for (int i = 0; i < n_zones; i++) {
+		struct prof_zone* zone = prof_get_zone(i);
+		float x0 = x_origin + zone->depth * indent;
+		float y1 = y_origin - i * row_height;
+		float ym = y1 - row_height * 0.5f;
+		float y0 = y1 - row_height * 0.9f;
+		render_flat_quad(render, x0, ym, x0 + zone->cpu_ms_avg * x_per_ms, y1, cpu_color);
+		render_flat_quad(render, x0, y0, x0 + zone->gpu_ms_avg * x_per_ms, ym, gpu_color);
 	}
 
+	float tick_x = x_origin + 16.667f * x_per_ms;
+	render_flat_quad(render, tick_x, y_end, tick_x + 0.004f, y_origin, tick_color);
+
 	vtxbuf_end(&render->vtxbuf);
+}
 
+void render_blank(struct render* render)
+{
+	AN(render);
+	glBindFramebuffer(GL_FRAMEBUFFER, render->fbo); CHKGL;
+	int width;
+	int height;
+	render_get_size(render, &width, &height);
+	glViewport(0, 0, width, height); CHKGL;
+	glClearColor(0,0,0,1);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
 void render_flip(struct render* render)
 {
 	AN(render);
-	SDL_GL_SwapWindow(render->window);
+	if (render->window) {
+		SDL_GL_SwapWindow(render->window);
+	} else {
+		// no swap to throttle us; don't let commands queue up forever
+		glFlush();
+	}
 }
 
@@ -9,12 +9,38 @@
 struct render {
 	SDL_Window* window;
 
+	// offscreen target; used when window is NULL
+	int width, height;
+	GLuint fbo;
+	GLuint fbo_renderbuffers[2]; // color, depth
+
 	struct vtxbuf vtxbuf;
 	struct shader nullmat_shader;
+	struct shader flat_shader;
+	struct shader prop_shader;
+	GLuint view_ubo; // struct render_view_block
+
+	// static GPU data for the current level; see render_set_lvl()
+	struct lvl* lvl;
+	GLuint chunk_vao;
+	GLuint chunk_buffers[2]; // vertices, indices
+	int* chunk_index_offsets;
+	int* chunk_index_counts;
+	GLuint prop_vao;
+	GLuint prop_buffers[3]; // vertices, indices, instance transforms
+	int* mesh_index_offsets;
+	int* mesh_index_counts;
+	int* chunk_instance_offsets;
 };
 
 void render_init(struct render* render, SDL_Window* window);
+void render_init_offscreen(struct render* render, int width, int height);
+void render_get_size(struct render* render, int* width, int* height);
+void render_read_pixels(struct render* render, uint8_t* rgba); // width*height*4 bytes
+void render_set_lvl(struct render* render, struct lvl* lvl); // uploads static level data; NULL releases it
 void render_lvl(struct render* render, struct lvl* lvl, struct lvl_entity* entity);
+void render_blank(struct render* render); // clears; for frames without a level
+void render_prof_overlay(struct render* render);
 void render_flip(struct render* render);
 
 #define RENDER_H
@@ -1,34 +1,72 @@
 #ifndef SCRATCH_H
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 
 #include "a.h"
 
+/*
+blocks are linked through a header at the start of each block. blocks are
+normally `increment` bytes; allocations that don't fit in an empty block of
+that size get a dedicated, larger block, which is linked in just before the
+current block. after scratch_reset() dedicated blocks are reused like any
+other block.
+*/
+struct scratch_block {
+	struct scratch_block* next;
+	size_t size; // including header
+};
+
+struct scratch_stats {
+	size_t n_allocs;
+	size_t bytes_requested; // sum of requested sizes
+	size_t bytes_reserved; // sum of block sizes
+	int n_blocks;
+	int n_oversized_blocks;
+	size_t alignment_waste; // padding inserted to satisfy alignment
+	size_t tail_waste; // unused space skipped at the end of blocks
+	size_t in_use; // bytes consumed since last reset, including waste
+	size_t high_water; // max in_use ever seen
+};
+
 struct scratch {
 	size_t increment;
-	void* first;
+	struct scratch_block* first;
 
 	// state
-	void* current;
+	struct scratch_block* current;
 	size_t used_in_current;
+
+	struct scratch_stats stats;
 };
 
 inline static void scratch_reset(struct scratch* s)
 {
 	s->current = s->first;
-	s->used_in_current = sizeof(void*);
+	s->used_in_current = sizeof(struct scratch_block);
+	s->stats.in_use = 0;
+}
+
+inline static struct scratch_block* scratch_new_block(struct scratch* s, size_t size)
+{
+	struct scratch_block* block = malloc(size);
+	AN(block);
+	block->next = NULL;
+	block->size = size;
+	s->stats.n_blocks++;
+	s->stats.bytes_reserved += size;
+	return block;
 }
 
 inline static void scratch_init(struct scratch* s, size_t increment)
 {
 	AN(s);
-	ASSERT(increment > sizeof(void*));
+	ASSERT(increment > sizeof(struct scratch_block));
 	memset(s, 0, sizeof(*s));
 	s->increment = increment;
-	AN(s->first = malloc(increment));
-	void** next = (void**)s->first;
-	*next = NULL;
+	s->first = scratch_new_block(s, increment);
 	scratch_reset(s);
 }
 
@@ -42,12 +80,12 @@ inline static void scratch_free(struct scratch* s)
 {
 	scratch_assert_valid(s);
 
-	void* current;
-	void* next;
+	struct scratch_block* current;
+	struct scratch_block* next;
 
 	current = s->first;
 	while (current) {
-		next = *((void**)current);
+		next = current->next;
 		free(current);
 		current = next;
 	}
@@ -56,8 +94,9 @@ inline static void scratch_free(struct scratch* s)
 }
 
 struct scratch_savepoint {
-	void* current;
+	struct scratch_block* current;
 	size_t used_in_current;
+	size_t in_use;
 };
 
 inline static struct scratch_savepoint scratch_save(struct scratch* s)
@@ -67,6 +106,7 @@ inline static struct scratch_savepoint scratch_save(struct scratch* s)
 	struct scratch_savepoint sp;
 	sp.current = s->current;
 	sp.used_in_current = s->used_in_current;
+	sp.in_use = s->stats.in_use;
 	return sp;
 }
 
@@ -75,55 +115,101 @@ inline static void scratch_recall(struct scratch* s, struct scratch_savepoint sp
 	scratch_assert_valid(s);
 	s->current = sp.current;
 	s->used_in_current = sp.used_in_current;
+	s->stats.in_use = sp.in_use;
 }
 
-inline static void* scratch_alloc_aligned_log2(struct scratch* s, size_t sz, int alignment_log2)
+inline static struct scratch_stats scratch_get_stats(struct scratch* s)
 {
 	scratch_assert_valid(s);
+	return s->stats;
+}
 
-	if (sz == 0) return NULL;
+inline static void scratch_dump_stats(FILE* f, const char* name, struct scratch* s)
+{
+	struct scratch_stats st = scratch_get_stats(s);
+	fprintf(f,
+		"scratch %s: %zd allocs, %zd bytes requested, %zd bytes reserved in %d blocks (%d oversized), "
+		"%zd alignment waste, %zd tail waste, %zd in use, %zd high water\n",
+		name,
+		st.n_allocs, st.bytes_requested, st.bytes_reserved, st.n_blocks, st.n_oversized_blocks,
+		st.alignment_waste, st.tail_waste, st.in_use, st.high_water);
+}
 
-	int alignment = 1 << alignment_log2;
-	int mask = alignment - 1;
-	int again;
-	for (again = 0; again < 2; again++) {
-		// align allocation
-		s->used_in_current = (s->used_in_current + mask) & ~mask;
+inline static void scratch_update_high_water(struct scratch* s)
+{
+	if (s->stats.in_use > s->stats.high_water) s->stats.high_water = s->stats.in_use;
+}
 
-		// save offset
-		size_t offset = s->used_in_current;
+inline static void* scratch_alloc_aligned_log2(struct scratch* s, size_t sz, int alignment_log2)
+{
+	scratch_assert_valid(s);
 
-		// add allocation to used
-		s->used_in_current += sz;
+	if (sz == 0) return NULL;
 
-		// check we're within bounds
-		if (s->used_in_current > s->increment)  {
-			// second try should always succeed, otherwise throw up
-			if (again) {
-				arghf(
-					"allocation of %zd bytes with alignment %d "
-					"does not fit in scratch allocator "
-					"with %zd increment",
-					sz, alignment, s->increment);
+	size_t alignment = (size_t)1 << alignment_log2;
+	size_t mask = alignment - 1;
+	const size_t header = sizeof(struct scratch_block);
+
+	s->stats.n_allocs++;
+	s->stats.bytes_requested += sz;
+
+	// allocations that wouldn't fit in an empty regular block get a
+	// dedicated block. it's linked in before the current block, so it
+	// counts as used, and the free space in the current block isn't lost
+	size_t offset = (header + mask) & ~mask;
+	if ((offset + sz) > s->increment) {
+		// after a reset, reuse a big enough free block ahead of current
+		struct scratch_block* block = NULL;
+		for (struct scratch_block* prev = s->current; prev->next != NULL; prev = prev->next) {
+			if (prev->next->size >= (offset + sz)) {
+				block = prev->next;
+				prev->next = block->next;
+				break;
 			}
+		}
+		if (block == NULL) {
+			block = scratch_new_block(s, offset + sz);
+			s->stats.n_oversized_blocks++;
+		}
 
-			// allocate new block if end of linked list
-			void** next = (void**)s->current;
-			if (*next == NULL) {
-				AN(*next = malloc(s->increment));
-				*((void**)*next) = NULL;
-			}
-			s->current = *next;
-			s->used_in_current = sizeof(void*);
+		if (s->current == s->first) {
+			s->first = block;
+		} else {
+			struct scratch_block* prev = s->first;
+			while (prev->next != s->current) prev = prev->next;
+			prev->next = block;
+		}
+		block->next = s->current;
+
+		s->stats.alignment_waste += offset - header;
+		s->stats.in_use += block->size;
+		scratch_update_high_water(s);
+		return (void*) ((uint8_t*)block + offset);
+	}
 
-			// try again, this time allocate or bust
-			continue;
+	for (;;) {
+		// align allocation
+		offset = (s->used_in_current + mask) & ~mask;
+
+		// check we're within bounds
+		if ((offset + sz) <= s->current->size) {
+			s->stats.alignment_waste += offset - s->used_in_current;
+			s->stats.in_use += (offset + sz) - s->used_in_current;
+			scratch_update_high_water(s);
+			s->used_in_current = offset + sz;
+			return (void*) ((uint8_t*)s->current + offset);
 		}
 
-		// return allocated memory
-		return (void*) ((uint8_t*)s->current + offset);
+		// move on to next block; allocate new block if end of linked
+		// list. a regular block always fits the allocation
+		s->stats.tail_waste += s->current->size - s->used_in_current;
+		s->stats.in_use += s->current->size - s->used_in_current;
+		if (s->current->next == NULL) {
+			s->current->next = scratch_new_block(s, s->increment);
+		}
+		s->current = s->current->next;
+		s->used_in_current = header;
 	}
-	arghf("unreachable");
 }
 
 inline static void* scratch_alloc_a1(struct scratch* s, size_t sz)
@@ -1,18 +1,166 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "a.h"
 #include "shader.h"
 
-static int shader_attr_type_floats(enum shader_attr_type type)
+struct shader_attr_format {
+	GLint size;
+	GLenum type;
+	GLboolean normalized;
+	size_t bytes;
+};
+
+static struct shader_attr_format shader_attr_type_format(enum shader_attr_type type)
 {
+	struct shader_attr_format f;
 	switch (type) {
-		case SHADER_ATTR_FLOAT: return 1;
-		case SHADER_ATTR_VEC2: return 2;
-		case SHADER_ATTR_VEC3: return 3;
-		case SHADER_ATTR_VEC4: return 4;
-		default: return -1;
+		case SHADER_ATTR_FLOAT: f = (struct shader_attr_format) {1, GL_FLOAT, GL_FALSE, 4}; break;
+		case SHADER_ATTR_VEC2: f = (struct shader_attr_format) {2, GL_FLOAT, GL_FALSE, 8}; break;
+		case SHADER_ATTR_VEC3: f = (struct shader_attr_format) {3, GL_FLOAT, GL_FALSE, 12}; break;
+		case SHADER_ATTR_VEC4: f = (struct shader_attr_format) {4, GL_FLOAT, GL_FALSE, 16}; break;
+		case SHADER_ATTR_HALF2: f = (struct shader_attr_format) {2, GL_HALF_FLOAT, GL_FALSE, 4}; break;
+		case SHADER_ATTR_INT_2_10_10_10_REV: f = (struct shader_attr_format) {4, GL_INT_2_10_10_10_REV, GL_TRUE, 4}; break;
+		case SHADER_ATTR_SHORT3N: f = (struct shader_attr_format) {3, GL_SHORT, GL_TRUE, 6}; break;
+		case SHADER_ATTR_SHORT: f = (struct shader_attr_format) {1, GL_SHORT, GL_FALSE, 2}; break;
+		default: arghf("unhandled attr type %d", type);
+	}
+	return f;
+}
+
+static struct {
+	int initialized;
+	int has_program_binary;
+	int has_parallel_compile;
+	uint64_t driver_hash;
+} shader_globals;
+
+static uint64_t fnv1a64(uint64_t hash, const void* data, size_t sz)
+{
+	const uint8_t* p = data;
+	for (size_t i = 0; i < sz; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static uint64_t fnv1a64_str(uint64_t hash, const char* str)
+{
+	// include terminator so that ("ab","c") and ("a","bc") differ
+	return fnv1a64(hash, str ? str : "", str ? strlen(str) + 1 : 1);
+}
+
+static void shader_globals_init()
+{
+	if (shader_globals.initialized) return;
+	shader_globals.initialized = 1;
+
+	GLint n_formats = 0;
+	if (platform_gl_version() >= 41 || platform_has_gl_extension("GL_ARB_get_program_binary")) {
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &n_formats); CHKGL;
 	}
+	shader_globals.has_program_binary = n_formats > 0;
+
+	if (platform_has_gl_extension("GL_KHR_parallel_shader_compile")) {
+		shader_globals.has_parallel_compile = 1;
+		glMaxShaderCompilerThreadsKHR(0xffffffff); CHKGL; // driver decides
+	}
+
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	hash = fnv1a64_str(hash, (const char*)glGetString(GL_VENDOR));
+	hash = fnv1a64_str(hash, (const char*)glGetString(GL_RENDERER));
+	hash = fnv1a64_str(hash, (const char*)glGetString(GL_VERSION));
+	shader_globals.driver_hash = hash;
+}
+
+struct shader_cache_header {
+	char magic[8];
+	uint64_t key;
+	uint32_t format;
+	uint32_t length;
+};
+
+static const char shader_cache_magic[8] = "FMTPSHDR";
+
+static void shader_cache_path(struct shader* shader, char* path, size_t sz)
+{
+	snprintf(path, sz, "%s/shader-%016llx.bin", SHADER_CACHE_DIR, (unsigned long long)shader->key);
+}
+
+static int shader_cache_load(struct shader* shader)
+{
+	if (!shader_globals.has_program_binary) return 0;
+
+	char path[1024];
+	shader_cache_path(shader, path, sizeof(path));
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) return 0;
+
+	int ok = 0;
+	void* binary = NULL;
+	struct shader_cache_header header;
+	if (fread(&header, sizeof(header), 1, f) != 1) goto done;
+	if (memcmp(header.magic, shader_cache_magic, sizeof(header.magic)) != 0) goto done;
+	if (header.key != shader->key) goto done;
+	// a truncated or corrupted file is a miss, not a huge allocation
+	long start = ftell(f);
+	if (start < 0 || fseek(f, 0, SEEK_END) != 0) goto done;
+	long end = ftell(f);
+	if (end < 0 || header.length == 0 || (long)header.length != (end - start)) goto done;
+	if (fseek(f, start, SEEK_SET) != 0) goto done;
+	AN(binary = malloc(header.length));
+	if (fread(binary, header.length, 1, f) != 1) goto done;
+
+	glProgramBinary(shader->program, header.format, binary, header.length);
+	// a rejected binary is not a GL error; it just fails to link
+	while (glGetError() != GL_NO_ERROR) {}
+
+	GLint status;
+	glGetProgramiv(shader->program, GL_LINK_STATUS, &status);
+	ok = status == GL_TRUE;
+
+done:
+	free(binary);
+	fclose(f);
+	return ok;
+}
+
+static void shader_cache_save(struct shader* shader)
+{
+	if (!shader_globals.has_program_binary) return;
+
+	GLint length = 0;
+	glGetProgramiv(shader->program, GL_PROGRAM_BINARY_LENGTH, &length); CHKGL;
+	if (length <= 0) return;
+
+	struct shader_cache_header header;
+	memcpy(header.magic, shader_cache_magic, sizeof(header.magic));
+	header.key = shader->key;
+	header.length = length;
+	void* binary = malloc(length);
+	AN(binary);
+	GLenum format;
+	glGetProgramBinary(shader->program, length, NULL, &format, binary); CHKGL;
+	header.format = format;
+
+	platform_mkdir(SHADER_CACHE_DIR);
+
+	// write to a temporary file and rename, so a concurrently starting
+	// process never sees a half-written binary
+	char path[1024];
+	char tmppath[1040];
+	shader_cache_path(shader, path, sizeof(path));
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	FILE* f = fopen(tmppath, "wb");
+	if (f != NULL) {
+		int ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(binary, length, 1, f) == 1;
+		ok = (fclose(f) == 0) && ok;
+		if (!ok || rename(tmppath, path) != 0) remove(tmppath);
+	}
+
+	free(binary);
 }
 
 static GLuint create_shader(GLenum type, const char* src)
@@ -20,7 +168,11 @@ static GLuint create_shader(GLenum type, const char* src)
 	GLuint shader = glCreateShader(type); CHKGL;
 	glShaderSource(shader, 1, &src, 0);
 	glCompileShader(shader);
+	return shader;
+}
 
+static void check_shader(GLuint shader, GLenum type, const char* src)
+{
 	GLint status;
 	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
 	if (status == GL_FALSE) {
@@ -31,26 +183,80 @@ static GLuint create_shader(GLenum type, const char* src)
 		const char* stype = type == GL_VERTEX_SHADER ? "vertex" : type == GL_FRAGMENT_SHADER ? "fragment" : "waaaat";
 		arghf("%s shader error: %s -- source:\n%s", stype, msg, src);
 	}
-	return shader;
 }
 
-void shader_init(struct shader* shader, const char* vert_src, const char* frag_src, struct shader_attr_spec* attr_specs)
+void shader_start(struct shader* shader, const char* vert_src, const char* frag_src, struct shader_attr_spec* attr_specs)
 {
+	shader_globals_init();
+
 	memset(shader, 0, sizeof(*shader));
 
-	GLuint vertex_shader = create_shader(GL_VERTEX_SHADER, vert_src);
-	GLuint fragment_shader = create_shader(GL_FRAGMENT_SHADER, frag_src);
+	uint64_t key = shader_globals.driver_hash;
+	key = fnv1a64_str(key, vert_src);
+	key = fnv1a64_str(key, frag_src);
+
+	int i = 0;
+	for (struct shader_attr_spec* spec = attr_specs; spec->symbol != NULL; spec++, i++) {
+		ASSERT(i < SHADER_MAX_ATTRS);
+		shader->attr_locations[i] = i;
+		shader->attr_types[i] = spec->type;
+		shader->attr_per_instance[i] = spec->per_instance;
+		size_t bytes = shader_attr_type_format(shader->attr_types[i]).bytes;
+		if (spec->per_instance) {
+			shader->instance_stride += bytes;
+		} else {
+			shader->stride += bytes;
+		}
+		key = fnv1a64_str(key, spec->symbol);
+	}
+	shader->n_attrs = i;
+	shader->key = key;
 
 	shader->program = glCreateProgram(); CHKGL;
 
-	glAttachShader(shader->program, vertex_shader);
-	glAttachShader(shader->program, fragment_shader);
+	if (shader_cache_load(shader)) return;
+
+	shader->pending = 1;
+	shader->vert_src = vert_src;
+	shader->frag_src = frag_src;
+
+	shader->vertex_shader = create_shader(GL_VERTEX_SHADER, vert_src);
+	shader->fragment_shader = create_shader(GL_FRAGMENT_SHADER, frag_src);
+
+	glAttachShader(shader->program, shader->vertex_shader);
+	glAttachShader(shader->program, shader->fragment_shader);
+
+	for (i = 0; i < shader->n_attrs; i++) {
+		glBindAttribLocation(shader->program, shader->attr_locations[i], attr_specs[i].symbol); CHKGL;
+	}
+
+	if (shader_globals.has_program_binary) {
+		glProgramParameteri(shader->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE); CHKGL;
+	}
 
 	glLinkProgram(shader->program);
+}
+
+int shader_is_ready(struct shader* shader)
+{
+	if (!shader->pending || !shader_globals.has_parallel_compile) return 1;
+	GLint status;
+	glGetProgramiv(shader->program, GL_COMPLETION_STATUS_KHR, &status); CHKGL;
+	return status == GL_TRUE;
+}
+
+void shader_finish(struct shader* shader)
+{
+	if (!shader->pending) return;
+	shader->pending = 0;
 
 	GLint status;
 	glGetProgramiv(shader->program, GL_LINK_STATUS, &status);
 	if (status == GL_FALSE) {
+		// compile errors are more informative than link errors
+		check_shader(shader->vertex_shader, GL_VERTEX_SHADER, shader->vert_src);
+		check_shader(shader->fragment_shader, GL_FRAGMENT_SHADER, shader->frag_src);
+
 		GLint msglen;
 		glGetProgramiv(shader->program, GL_INFO_LOG_LENGTH, &msglen);
 		GLchar* msg = (GLchar*) malloc(msglen + 1);
@@ -58,18 +264,20 @@ void shader_init(struct shader* shader, const char* vert_src, const char* frag_s
 		arghf("shader link error: %s", msg);
 	}
 
-	glDeleteShader(vertex_shader);
-	glDeleteShader(fragment_shader);
+	glDetachShader(shader->program, shader->vertex_shader);
+	glDetachShader(shader->program, shader->fragment_shader);
+	glDeleteShader(shader->vertex_shader);
+	glDeleteShader(shader->fragment_shader);
+	shader->vertex_shader = shader->fragment_shader = 0;
+	shader->vert_src = shader->frag_src = NULL;
 
-	int i = 0;
-	size_t stride = 0;
-	for (struct shader_attr_spec* spec = attr_specs; spec->symbol != NULL; spec++, i++) {
-		shader->attr_locations[i] = glGetAttribLocation(shader->program, spec->symbol); CHKGL;
-		shader->attr_types[i] = spec->type;
-		stride += shader_attr_type_floats(shader->attr_types[i]) * sizeof(float);
-	}
-	shader->n_attrs = i;
-	shader->stride = stride;
+	shader_cache_save(shader);
+}
+
+void shader_init(struct shader* shader, const char* vert_src, const char* frag_src, struct shader_attr_spec* attr_specs)
+{
+	shader_start(shader, vert_src, frag_src, attr_specs);
+	shader_finish(shader);
 }
 
 void shader_use(struct shader* shader)
@@ -81,9 +289,22 @@ void shader_set_attrib_pointers(struct shader* shader)
 {
 	char* offset = 0;
 	for (int i = 0; i < shader->n_attrs; i++) {
-		int n_floats = shader_attr_type_floats(shader->attr_types[i]);
-		glVertexAttribPointer(shader->attr_locations[i], n_floats, GL_FLOAT, GL_FALSE, shader->stride, offset); CHKGL;
-		offset += n_floats * sizeof(float);
+		if (shader->attr_per_instance[i]) continue;
+		struct shader_attr_format f = shader_attr_type_format(shader->attr_types[i]);
+		glVertexAttribPointer(shader->attr_locations[i], f.size, f.type, f.normalized, shader->stride, offset); CHKGL;
+		offset += f.bytes;
+	}
+}
+
+void shader_set_instance_attrib_pointers(struct shader* shader, size_t offset)
+{
+	char* p = (char*)(uintptr_t)offset;
+	for (int i = 0; i < shader->n_attrs; i++) {
+		if (!shader->attr_per_instance[i]) continue;
+		struct shader_attr_format f = shader_attr_type_format(shader->attr_types[i]);
+		glVertexAttribPointer(shader->attr_locations[i], f.size, f.type, f.normalized, shader->instance_stride, p); CHKGL;
+		glVertexAttribDivisor(shader->attr_locations[i], 1); CHKGL;
+		p += f.bytes;
 	}
 }
 
@@ -125,6 +346,13 @@ void shader_uniform_mat44(struct shader* shader, const char* name, struct mat44
 	glUniformMatrix4fv(location, 1, GL_FALSE, m.s); CHKGL;
 }
 
+void shader_uniform_block_binding(struct shader* shader, const char* name, GLuint binding)
+{
+	GLuint index = glGetUniformBlockIndex(shader->program, name); CHKGL;
+	ASSERT(index != GL_INVALID_INDEX);
+	glUniformBlockBinding(shader->program, index, binding); CHKGL;
+}
+
 void shader_uniform_texture2D(struct shader* shader, const char* name, GLuint texture)
 {
 	shader_use(shader);
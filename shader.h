@@ -1,5 +1,7 @@
 #ifndef SHADER_H
 
+#include <stdint.h>
+
 #include "platform.h"
 #include "mat.h"
 
@@ -10,11 +12,18 @@ enum shader_attr_type {
 	SHADER_ATTR_VEC2,
 	SHADER_ATTR_VEC3,
 	SHADER_ATTR_VEC4,
+
+	// packed formats
+	SHADER_ATTR_HALF2, // 2 x half float
+	SHADER_ATTR_INT_2_10_10_10_REV, // signed normalized xyz (+2-bit w)
+	SHADER_ATTR_SHORT3N, // 3 x signed normalized 16-bit
+	SHADER_ATTR_SHORT, // 1 x signed 16-bit, not normalized; see shader_pack_oct16()
 };
 
 struct shader_attr_spec {
 	const char* symbol;
 	enum shader_attr_type type;
+	int per_instance; // sourced from a separate instance buffer; see shader_set_instance_attrib_pointers()
 };
 
 struct shader {
@@ -22,12 +31,41 @@ struct shader {
 	int n_attrs;
 	GLuint attr_locations[SHADER_MAX_ATTRS];
 	enum shader_attr_type attr_types[SHADER_MAX_ATTRS];
+	int attr_per_instance[SHADER_MAX_ATTRS];
 	size_t stride;
+	size_t instance_stride;
+
+	// program binary cache key; see shader_start()
+	uint64_t key;
+
+	// pending state between shader_start() and shader_finish()
+	int pending;
+	const char* vert_src;
+	const char* frag_src;
+	GLuint vertex_shader;
+	GLuint fragment_shader;
 };
 
-void shader_init(struct shader* shader, const char* vert_src, const char* frag_src, struct shader_attr_spec* attr_specs);
+/*
+shader_start() starts compiling and linking a shader and returns as soon as
+possible; shader_finish() waits for it to complete. start many shaders
+before finishing any of them to let drivers with
+GL_KHR_parallel_shader_compile compile them in parallel. linked programs
+are cached as program binaries in SHADER_CACHE_DIR, keyed on the sources,
+attributes and the GL vendor/renderer/version strings, so later runs can
+usually skip compilation altogether.
+
+vert_src and frag_src must stay valid until shader_finish(). attribute i in
+attr_specs is bound to location i.
+*/
+#define SHADER_CACHE_DIR "cache"
+void shader_start(struct shader* shader, const char* vert_src, const char* frag_src, struct shader_attr_spec* attr_specs);
+int shader_is_ready(struct shader* shader); // non-blocking; 1 if shader_finish() won't stall
+void shader_finish(struct shader* shader);
+void shader_init(struct shader* shader, const char* vert_src, const char* frag_src, struct shader_attr_spec* attr_specs); // start+finish
 void shader_use(struct shader* shader);
 void shader_set_attrib_pointers(struct shader* shader);
+void shader_set_instance_attrib_pointers(struct shader* shader, size_t offset);
 void shader_enable_arrays(struct shader* shader);
 void shader_disable_arrays(struct shader* shader);
 void shader_uniform_vec2(struct shader* shader, const char* name, union vec2 v);
@@ -35,6 +73,76 @@ void shader_uniform_vec3(struct shader* shader, const char* name, union vec3 v);
 void shader_uniform_mat33(struct shader* shader, const char* name, struct mat33 m);
 void shader_uniform_mat44(struct shader* shader, const char* name, struct mat44 m);
 void shader_uniform_uint(struct shader* shader, const char* name, GLuint texture);
+void shader_uniform_block_binding(struct shader* shader, const char* name, GLuint binding);
+
+// packing helpers for the packed attribute types
+
+inline static uint16_t shader_pack_half(float f)
+{
+	union { float f; uint32_t u; } x = { f };
+	uint32_t sign = (x.u >> 16) & 0x8000;
+	int32_t exponent = (int32_t)((x.u >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = x.u & 0x7fffff;
+
+	if (exponent <= 0) {
+		// denormal or zero
+		if (exponent < -10) return sign;
+		mantissa |= 0x800000;
+		return sign | ((mantissa >> (14 - exponent)) + ((mantissa >> (13 - exponent)) & 1));
+	} else if (exponent >= 31) {
+		// overflow (or nan) => inf
+		return sign | 0x7c00;
+	}
+
+	// round to nearest; carry into exponent is fine
+	return (sign | (exponent << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1);
+}
+
+inline static int16_t shader_pack_snorm16(float f)
+{
+	if (f > 1.0f) f = 1.0f;
+	if (f < -1.0f) f = -1.0f;
+	return (int16_t)lrintf(f * 32767.0f);
+}
+
+/*
+unit vector => octahedral encoding with 255 steps per axis (so that 0, and
+with it axis aligned vectors, are exact), as an integer for SHADER_ATTR_SHORT.
+integer, not normalized, because the snorm16 => float conversion differs
+between GL versions, and the two bytes have to be recovered exactly. the
+decoder is oct16_decode() in nullmat.vert.glsl; worst case error is about
+1 degree
+*/
+inline static int16_t shader_pack_oct16(union vec3 v)
+{
+	float l1 = fabsf(v.x) + fabsf(v.y) + fabsf(v.z);
+	float e[2] = {l1 > 0 ? v.x / l1 : 0, l1 > 0 ? v.y / l1 : 0};
+	if (v.z < 0) {
+		float x = e[0];
+		e[0] = (1 - fabsf(e[1])) * (x >= 0 ? 1 : -1);
+		e[1] = (1 - fabsf(x)) * (e[1] >= 0 ? 1 : -1);
+	}
+	int q[2];
+	for (int i = 0; i < 2; i++) {
+		q[i] = (int)lrintf((e[i] + 1.0f) * 127.0f);
+		if (q[i] < 0) q[i] = 0;
+		if (q[i] > 254) q[i] = 254;
+	}
+	return (int16_t)(q[0] * 256 + q[1] - 32768);
+}
+
+inline static uint32_t shader_pack_int_2_10_10_10_rev(union vec3 v)
+{
+	uint32_t packed = 0;
+	for (int i = 0; i < 3; i++) {
+		float f = v.s[i];
+		if (f > 1.0f) f = 1.0f;
+		if (f < -1.0f) f = -1.0f;
+		int32_t q = (int32_t)lrintf(f * 511.0f);
+		packed |= ((uint32_t)q & 0x3ff) << (i * 10);
+	}
+	return packed;
+}
 
 #define SHADER_H
 #endif
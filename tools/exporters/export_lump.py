@@ -63,7 +63,10 @@ for bo in bpy.data.objects:
 	elif bo.type == "EMPTY":
 		dummy = {}
 		dummy["props"] = get_custom_properties(bo)
-		dummy["tx"] = flatten_matrix(bo.matrix_world)
+		# instanced lumps are already in Y-up space (see above), so the
+		# dummy's transform is conjugated into Y-up space instead of being
+		# rotated once more: tx * (R * W_mesh * co) = R * W_dummy * W_mesh * co
+		dummy["tx"] = flatten_matrix(opengl_tx * bo.matrix_world * opengl_tx.inverted())
 		lump["dummies"].append(dummy)
 
 output = lson.dumps(lump)
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "prof.h"
+#include "a.h"
+
+struct trace_record {
+	uint64_t ns;
+	const char* name;
+	int64_t value;
+	int type;
+};
+
+// single producer (the owning thread), single consumer (trace_flush())
+struct trace_ring {
+	uint64_t head; // next write; owner
+	uint64_t tail; // next read; flusher
+	int64_t n_dropped;
+	int tid;
+	const char* thread_name;
+	const char* thread_name_written; // flusher
+	int released; // the owning thread exited; the ring is up for reuse
+	struct trace_record records[TRACE_RING_SIZE];
+};
+
+static struct {
+	int open;
+	FILE* f;
+	uint64_t base_ns;
+	int n_written;
+
+	int n_rings;
+	struct trace_ring* rings[TRACE_MAX_THREADS];
+} trace;
+
+static __thread struct trace_ring* trace_tls_ring;
+static __thread int trace_tls_no_ring;
+
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+
+// pthread key destructor; runs when a thread that has a ring exits. events
+// still in the ring are flushed as usual, later, under the same tid as
+// those of the next thread to take the ring over
+static void trace_release_ring(void* usr)
+{
+	struct trace_ring* ring = usr;
+	__atomic_store_n(&ring->released, 1, __ATOMIC_RELEASE);
+}
+
+static void trace_key_init()
+{
+	AZ(pthread_key_create(&trace_key, trace_release_ring));
+}
+
+static struct trace_ring* trace_reuse_ring()
+{
+	int n = __atomic_load_n(&trace.n_rings, __ATOMIC_ACQUIRE);
+	if (n > TRACE_MAX_THREADS) n = TRACE_MAX_THREADS;
+	for (int i = 0; i < n; i++) {
+		struct trace_ring* ring = __atomic_load_n(&trace.rings[i], __ATOMIC_ACQUIRE);
+		if (ring == NULL || !__atomic_load_n(&ring->released, __ATOMIC_ACQUIRE)) continue;
+		int released = 1;
+		if (__atomic_compare_exchange_n(&ring->released, &released, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&ring->thread_name, NULL, __ATOMIC_RELEASE);
+			return ring;
+		}
+	}
+	return NULL;
+}
+
+static struct trace_ring* trace_get_ring()
+{
+	struct trace_ring* ring = trace_tls_ring;
+	if (ring != NULL) return ring;
+	if (trace_tls_no_ring) return NULL;
+
+	AZ(pthread_once(&trace_key_once, trace_key_init));
+
+	// threads come and go (one loader per level load); rings of exited
+	// threads are reused before new ones are allocated
+	ring = trace_reuse_ring();
+	if (ring == NULL) {
+		int i = __sync_fetch_and_add(&trace.n_rings, 1);
+		if (i >= TRACE_MAX_THREADS) {
+			trace_tls_no_ring = 1;
+			return NULL;
+		}
+		AN(ring = calloc(1, sizeof(*ring)));
+		ring->tid = i + 1;
+		__atomic_store_n(&trace.rings[i], ring, __ATOMIC_RELEASE);
+	}
+	AZ(pthread_setspecific(trace_key, ring));
+	trace_tls_ring = ring;
+	return ring;
+}
+
+void trace_thread_name(const char* name)
+{
+	struct trace_ring* ring = trace_get_ring();
+	if (ring == NULL) return;
+	__atomic_store_n(&ring->thread_name, name, __ATOMIC_RELEASE);
+}
+
+void trace_event(enum trace_event_type type, const char* name, int64_t value)
+{
+	if (!__atomic_load_n(&trace.open, __ATOMIC_RELAXED)) return;
+	struct trace_ring* ring = trace_get_ring();
+	if (ring == NULL) return;
+
+	uint64_t head = ring->head;
+	if ((head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) >= TRACE_RING_SIZE) {
+		ring->n_dropped++;
+		return;
+	}
+	struct trace_record* r = &ring->records[head & (TRACE_RING_SIZE - 1)];
+	r->ns = prof_ns();
+	r->name = name;
+	r->value = value;
+	r->type = type;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_open(const char* path)
+{
+	ASSERT(!trace.open);
+	trace.f = fopen(path, "w");
+	if (trace.f == NULL) arghf("%s: could not open for writing", path);
+	fprintf(trace.f, "[\n");
+	trace.n_written = 0;
+	trace.base_ns = prof_ns();
+	// drop anything left over from a previous trace
+	for (int i = 0; i < trace.n_rings && i < TRACE_MAX_THREADS; i++) {
+		struct trace_ring* ring = trace.rings[i];
+		if (ring) ring->tail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	}
+	#ifndef TRACE
+	fprintf(stderr, "trace: built without -DTRACE; %s will only contain thread names\n", path);
+	#endif
+	__atomic_store_n(&trace.open, 1, __ATOMIC_RELEASE);
+}
+
+int trace_is_open()
+{
+	return trace.open;
+}
+
+static void trace_write_separator()
+{
+	if (trace.n_written++ > 0) fprintf(trace.f, ",\n");
+}
+
+static void trace_flush_ring(struct trace_ring* ring)
+{
+	const char* thread_name = __atomic_load_n(&ring->thread_name, __ATOMIC_ACQUIRE);
+	if (thread_name != NULL && thread_name != ring->thread_name_written) {
+		trace_write_separator();
+		fprintf(trace.f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", ring->tid, thread_name);
+		ring->thread_name_written = thread_name;
+	}
+
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	for (uint64_t i = ring->tail; i < head; i++) {
+		struct trace_record* r = &ring->records[i & (TRACE_RING_SIZE - 1)];
+		// events from before trace_open() can't exist, but clamp anyway
+		double ts_us = r->ns > trace.base_ns ? (double)(r->ns - trace.base_ns) * 1e-3 : 0.0;
+		trace_write_separator();
+		switch (r->type) {
+			case TRACE_EVENT_BEGIN:
+			case TRACE_EVENT_END:
+				fprintf(trace.f, "{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}",
+					r->name, r->type == TRACE_EVENT_BEGIN ? 'B' : 'E', ring->tid, ts_us);
+				break;
+			case TRACE_EVENT_COUNTER:
+				fprintf(trace.f, "{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"value\":%lld}}",
+					r->name, ring->tid, ts_us, (long long)r->value);
+				break;
+			default:
+				arghf("unhandled trace event type %d", r->type);
+		}
+	}
+	__atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+}
+
+static void trace_flush_rings()
+{
+	int n = __atomic_load_n(&trace.n_rings, __ATOMIC_ACQUIRE);
+	if (n > TRACE_MAX_THREADS) n = TRACE_MAX_THREADS;
+	for (int i = 0; i < n; i++) {
+		struct trace_ring* ring = __atomic_load_n(&trace.rings[i], __ATOMIC_ACQUIRE);
+		if (ring != NULL) trace_flush_ring(ring);
+	}
+	fflush(trace.f);
+}
+
+void trace_flush()
+{
+	if (!trace.open) return;
+	trace_flush_rings();
+}
+
+void trace_flush_if_full()
+{
+	if (!trace.open) return;
+	int n = __atomic_load_n(&trace.n_rings, __ATOMIC_ACQUIRE);
+	if (n > TRACE_MAX_THREADS) n = TRACE_MAX_THREADS;
+	for (int i = 0; i < n; i++) {
+		struct trace_ring* ring = __atomic_load_n(&trace.rings[i], __ATOMIC_ACQUIRE);
+		if (ring == NULL) continue;
+		uint64_t fill = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - ring->tail;
+		if (fill > (TRACE_RING_SIZE / 2)) {
+			trace_flush();
+			return;
+		}
+	}
+}
+
+void trace_close()
+{
+	if (!trace.open) return;
+	__atomic_store_n(&trace.open, 0, __ATOMIC_RELEASE);
+	trace_flush_rings();
+
+	fprintf(trace.f, "\n]\n");
+	fclose(trace.f);
+	trace.f = NULL;
+
+	int64_t n_dropped = 0;
+	for (int i = 0; i < trace.n_rings && i < TRACE_MAX_THREADS; i++) {
+		if (trace.rings[i]) n_dropped += trace.rings[i]->n_dropped;
+	}
+	if (n_dropped > 0) fprintf(stderr, "trace: %lld events dropped (ring full)\n", (long long)n_dropped);
+
+	// rings stay allocated; threads may still hold on to them, and a later
+	// trace_open() reuses them
+	for (int i = 0; i < trace.n_rings && i < TRACE_MAX_THREADS; i++) {
+		if (trace.rings[i]) trace.rings[i]->thread_name_written = NULL;
+	}
+}
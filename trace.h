@@ -0,0 +1,50 @@
+#ifndef TRACE_H
+
+#include <stdint.h>
+
+/*
+event tracing in Chrome's trace event format (load the output in
+chrome://tracing or ui.perfetto.dev). every thread appends begin/end/counter
+events to its own ring buffer without locking; trace_flush() drains all
+rings into the file opened by trace_open(). a full ring drops events
+(they're counted) rather than blocking the thread. rings of exited threads
+are handed to new threads (tid included), so short-lived threads such as
+the level loader don't use up TRACE_MAX_THREADS.
+
+the TRACE_* macros compile to nothing unless built with -DTRACE (see
+Makefile.linux). event names are stored by pointer, so they must be string
+literals or otherwise outlive the trace.
+*/
+
+#define TRACE_MAX_THREADS (64)
+#define TRACE_RING_SIZE (1<<16) // events per thread; power of two
+
+enum trace_event_type {
+	TRACE_EVENT_BEGIN = 0,
+	TRACE_EVENT_END,
+	TRACE_EVENT_COUNTER
+};
+
+void trace_open(const char* path);
+int trace_is_open();
+void trace_flush();
+void trace_flush_if_full(); // flushes if any ring is more than half full
+void trace_close();
+
+void trace_thread_name(const char* name);
+void trace_event(enum trace_event_type type, const char* name, int64_t value);
+
+#ifdef TRACE
+#define TRACE_BEGIN(name) trace_event(TRACE_EVENT_BEGIN, name, 0)
+#define TRACE_END(name) trace_event(TRACE_EVENT_END, name, 0)
+#define TRACE_COUNTER(name, value) trace_event(TRACE_EVENT_COUNTER, name, value)
+#define TRACE_THREAD_NAME(name) trace_thread_name(name)
+#else
+#define TRACE_BEGIN(name) do {} while (0)
+#define TRACE_END(name) do {} while (0)
+#define TRACE_COUNTER(name, value) do {} while (0)
+#define TRACE_THREAD_NAME(name) do {} while (0)
+#endif
+
+#define TRACE_H
+#endif
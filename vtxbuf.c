@@ -3,6 +3,9 @@
 #include <string.h>
 
 #include "vtxbuf.h"
+#include "prof.h"
+#include "trace.h"
+#include "counters.h"
 
 void vtxbuf_init(struct vtxbuf* vb, size_t sz)
 {
@@ -13,6 +16,36 @@ void vtxbuf_init(struct vtxbuf* vb, size_t sz)
 	glGenBuffers(1, &vb->buffer); CHKGL;
 	glBindBuffer(GL_ARRAY_BUFFER, vb->buffer); CHKGL;
 	glBufferData(GL_ARRAY_BUFFER, sz, vb->data, GL_STREAM_DRAW); CHKGL;
+
+	vb->index_capacity = sz / sizeof(*vb->indices);
+	vb->indices = malloc(vb->index_capacity * sizeof(*vb->indices));
+	AN(vb->indices);
+	glGenBuffers(1, &vb->index_buffer); CHKGL;
+	// storage is allocated through GL_ARRAY_BUFFER; binding
+	// GL_ELEMENT_ARRAY_BUFFER would change the current vao
+	glBindBuffer(GL_ARRAY_BUFFER, vb->index_buffer); CHKGL;
+	glBufferData(GL_ARRAY_BUFFER, vb->index_capacity * sizeof(*vb->indices), NULL, GL_STREAM_DRAW); CHKGL;
+	glBindBuffer(GL_ARRAY_BUFFER, vb->buffer); CHKGL;
+}
+
+static GLuint vtxbuf_get_vao(struct vtxbuf* vb, struct shader* shader)
+{
+	for (int i = 0; i < vb->n_vaos; i++) {
+		if (vb->vaos[i].shader == shader) return vb->vaos[i].vao;
+	}
+
+	ASSERT(vb->n_vaos < VTXBUF_MAX_VAOS);
+	struct vtxbuf_vao* v = &vb->vaos[vb->n_vaos++];
+	v->shader = shader;
+	glGenVertexArrays(1, &v->vao); CHKGL;
+	glBindVertexArray(v->vao); CHKGL;
+	glBindBuffer(GL_ARRAY_BUFFER, vb->buffer); CHKGL;
+	// element array binding is vao state
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vb->index_buffer); CHKGL;
+	shader_enable_arrays(shader);
+	shader_set_attrib_pointers(shader);
+	glBindVertexArray(0); CHKGL;
+	return v->vao;
 }
 
 void vtxbuf_begin(struct vtxbuf* vb, struct shader* shader, GLenum mode)
@@ -20,34 +53,111 @@ void vtxbuf_begin(struct vtxbuf* vb, struct shader* shader, GLenum mode)
 	vb->shader = shader;
 	vb->mode = mode;
 	vb->used = 0;
+	vb->indexed = 0;
+	vb->n_indices = 0;
+	vb->vao = vtxbuf_get_vao(vb, shader);
 	shader_use(shader);
-	shader_enable_arrays(shader);
+	glBindVertexArray(vb->vao); CHKGL;
+}
+
+void vtxbuf_begin_indexed(struct vtxbuf* vb, struct shader* shader, GLenum mode)
+{
+	vtxbuf_begin(vb, shader, mode);
+	vb->indexed = 1;
 }
 
 void vtxbuf_flush(struct vtxbuf* vb)
 {
 	if (vb->used == 0) return;
+	ASSERT(vb->n_reserved_vertices == 0 && vb->n_reserved_indices == 0);
+
+	prof_begin("vtxbuf_flush");
+	TRACE_BEGIN("vtxbuf_flush");
 
 	glBindBuffer(GL_ARRAY_BUFFER, vb->buffer); CHKGL;
 	glBufferSubData(GL_ARRAY_BUFFER, 0, vb->used, vb->data); CHKGL;
 
-	shader_set_attrib_pointers(vb->shader);
-	glBindBuffer(GL_ARRAY_BUFFER, vb->buffer); CHKGL;
-	glDrawArrays(vb->mode, 0, vb->used / vb->shader->stride);
+	int n_vertices = vb->used / vb->shader->stride;
+	if (vb->indexed) {
+		// the vao binds the index buffer
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, vb->n_indices * sizeof(*vb->indices), vb->indices); CHKGL;
+		glDrawElements(vb->mode, vb->n_indices, GL_UNSIGNED_SHORT, 0); CHKGL;
+	} else {
+		glDrawArrays(vb->mode, 0, n_vertices);
+	}
+	COUNTER_ADD(COUNTER_VTXBUF_FLUSHES, 1);
+	COUNTER_ADD(COUNTER_DRAW_CALLS, 1);
+	if (vb->mode == GL_TRIANGLES) COUNTER_ADD(COUNTER_VTXBUF_TRIANGLES, (vb->indexed ? vb->n_indices : n_vertices) / 3);
 	vb->used = 0;
+	vb->n_indices = 0;
+
+	TRACE_END("vtxbuf_flush");
+	prof_end();
 }
 
 void vtxbuf_end(struct vtxbuf* vb)
 {
 	vtxbuf_flush(vb);
-	shader_disable_arrays(vb->shader);
+	glBindVertexArray(0); CHKGL;
 }
 
-void vtxbuf_element(struct vtxbuf* vb, float* data, size_t sz)
+void vtxbuf_element(struct vtxbuf* vb, const void* data, size_t sz)
 {
+	ASSERT(!vb->indexed);
 	if ((vb->used + sz) > vb->sz) vtxbuf_flush(vb);
 	if ((vb->used + sz) > vb->sz) WRONG("not enough room for even one element");
 	memcpy(((uint8_t*)vb->data) + vb->used, data, sz);
 	vb->used += sz;
+	COUNTER_ADD(COUNTER_VTXBUF_BYTES, sz);
 }
 
+void* vtxbuf_reserve(struct vtxbuf* vb, int n_vertices)
+{
+	ASSERT(!vb->indexed);
+	ASSERT(n_vertices > 0);
+	size_t sz = n_vertices * vb->shader->stride;
+	if ((vb->used + sz) > vb->sz) vtxbuf_flush(vb);
+	if ((vb->used + sz) > vb->sz) WRONG("not enough room for even one reservation");
+	vb->n_reserved_vertices = n_vertices;
+	return ((uint8_t*)vb->data) + vb->used;
+}
+
+void vtxbuf_commit(struct vtxbuf* vb, int n_vertices)
+{
+	ASSERT(n_vertices >= 0 && n_vertices <= vb->n_reserved_vertices);
+	size_t sz = n_vertices * vb->shader->stride;
+	vb->used += sz;
+	vb->n_reserved_vertices = 0;
+	COUNTER_ADD(COUNTER_VTXBUF_BYTES, sz);
+}
+
+static int vtxbuf_indexed_fits(struct vtxbuf* vb, int n_vertices, int n_indices)
+{
+	size_t stride = vb->shader->stride;
+	return
+		(vb->used + n_vertices * stride) <= vb->sz
+		&& (vb->n_indices + n_indices) <= vb->index_capacity
+		&& (vb->used / stride + n_vertices) <= VTXBUF_MAX_INDEXED_VERTICES;
+}
+
+void* vtxbuf_reserve_indexed(struct vtxbuf* vb, int n_vertices, int n_indices, uint16_t** indices, uint16_t* base)
+{
+	ASSERT(vb->indexed);
+	ASSERT(n_vertices > 0 && n_indices > 0);
+	if (!vtxbuf_indexed_fits(vb, n_vertices, n_indices)) vtxbuf_flush(vb);
+	if (!vtxbuf_indexed_fits(vb, n_vertices, n_indices)) WRONG("not enough room for even one reservation");
+	vb->n_reserved_vertices = n_vertices;
+	vb->n_reserved_indices = n_indices;
+	*indices = &vb->indices[vb->n_indices];
+	*base = vb->used / vb->shader->stride;
+	return ((uint8_t*)vb->data) + vb->used;
+}
+
+void vtxbuf_commit_indexed(struct vtxbuf* vb, int n_vertices, int n_indices)
+{
+	ASSERT(n_indices >= 0 && n_indices <= vb->n_reserved_indices);
+	vtxbuf_commit(vb, n_vertices);
+	vb->n_indices += n_indices;
+	vb->n_reserved_indices = 0;
+	COUNTER_ADD(COUNTER_VTXBUF_BYTES, n_indices * sizeof(*vb->indices));
+}
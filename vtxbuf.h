@@ -1,21 +1,70 @@
 #ifndef VTXBUF_H
 
+#include <stdint.h>
+
 #include "platform.h"
 #include "shader.h"
 
+#define VTXBUF_MAX_VAOS (8)
+#define VTXBUF_MAX_INDEXED_VERTICES (1<<16) // per batch; indices are 16 bit
+
+struct vtxbuf_vao {
+	struct shader* shader;
+	GLuint vao;
+};
+
 struct vtxbuf {
 	GLuint buffer;
 	size_t sz, used;
-	float* data;
+	void* data;
 	struct shader* shader;
 	GLenum mode;
+
+	// companion index buffer, for batches started with vtxbuf_begin_indexed()
+	GLuint index_buffer;
+	int indexed;
+	int index_capacity, n_indices;
+	uint16_t* indices;
+
+	int n_reserved_vertices, n_reserved_indices; // until commit
+
+	/*
+	vertex array objects are cached per shader (the buffers are always
+	vb->buffer and vb->index_buffer), so attribute pointers are only
+	specified once
+	*/
+	int n_vaos;
+	struct vtxbuf_vao vaos[VTXBUF_MAX_VAOS];
+	GLuint vao;
 };
 
+// sz is the vertex buffer size in bytes; the index buffer gets the same
 void vtxbuf_init(struct vtxbuf* vb, size_t sz);
 void vtxbuf_begin(struct vtxbuf* vb, struct shader* shader, GLenum mode);
+void vtxbuf_begin_indexed(struct vtxbuf* vb, struct shader* shader, GLenum mode);
 void vtxbuf_flush(struct vtxbuf* vb);
 void vtxbuf_end(struct vtxbuf* vb);
-void vtxbuf_element(struct vtxbuf* vb, float* data, size_t sz);
+
+// copies sz bytes of whole vertices; non-indexed batches only
+void vtxbuf_element(struct vtxbuf* vb, const void* data, size_t sz);
+
+/*
+zero-copy writes: vtxbuf_reserve() returns room for n_vertices vertices in
+the buffer (flushing first if they don't fit), which the caller writes
+directly; vtxbuf_commit() then adds the first n_vertices of them to the
+batch (at most as many as were reserved). nothing else may touch vb in
+between. the returned memory is not initialized, and is only valid until
+the commit.
+
+vtxbuf_reserve_indexed() is the same for indexed batches; it also returns
+room for n_indices indices in *indices, and in *base the index of the first
+reserved vertex, which indices are relative to the batch, so must be offset
+by.
+*/
+void* vtxbuf_reserve(struct vtxbuf* vb, int n_vertices);
+void vtxbuf_commit(struct vtxbuf* vb, int n_vertices);
+void* vtxbuf_reserve_indexed(struct vtxbuf* vb, int n_vertices, int n_indices, uint16_t** indices, uint16_t* base);
+void vtxbuf_commit_indexed(struct vtxbuf* vb, int n_vertices, int n_indices);
 
 #define VTXBUF_H
 #endif